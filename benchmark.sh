@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# Deterministic renders of every built in scene, timings go to benchmark.json.
+# Arguments are passed through, e.g. ./benchmark.sh --spp 32 --threads 1,2,4
+mkdir -p targets;
+rm -f targets/benchmark;
+clang++ -Ofast -ffast-math -march=native -std=c++14 -lm -pthread -o targets/benchmark src/benchmark.cpp;
+./targets/benchmark "$@";
@@ -2,5 +2,5 @@
 
 mkdir -p targets;
 rm -f targets/yellow;
-clang++ -Ofast -ffast-math -std=c++14 -lm -pthread -o targets/yellow src/yellow.cpp;
+clang++ -Ofast -ffast-math -march=native -std=c++14 -lm -pthread -o targets/yellow src/yellow.cpp;
 ./targets/yellow;
@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# Behaviour checks, every fast path against a slow one it has to agree with.
+# Runs in targets/ and exits nonzero if any check failed.
+mkdir -p targets;
+rm -f targets/checks;
+clang++ -Ofast -ffast-math -march=native -std=c++14 -lm -pthread -o targets/checks src/checks.cpp;
+cd targets && ./checks;
@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# ns/op and cycles/op for the intersection kernels, camera rays, samplers and
+# color conversion on fixed inputs
+mkdir -p targets;
+rm -f targets/microbench;
+clang++ -Ofast -ffast-math -march=native -std=c++14 -lm -pthread -o targets/microbench src/microbench.cpp;
+./targets/microbench;
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# Mrays/s at 1..N threads with per-thread counters and with the old shared
+# counters, side by side
+mkdir -p targets;
+for layout in per_thread shared; do
+	flags="-DYELLOW_THREAD_SCALING";
+	if [ "$layout" = "shared" ]; then
+		flags="$flags -DYELLOW_SHARED_COUNTERS";
+	fi
+	rm -f targets/yellow_scaling_$layout;
+	clang++ -Ofast -ffast-math -march=native -std=c++14 $flags -lm -pthread -o targets/yellow_scaling_$layout src/yellow.cpp;
+	echo "[layout] $layout";
+	./targets/yellow_scaling_$layout | grep "\[scaling\]";
+done
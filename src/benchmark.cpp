@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "types.h"
+#include "threads.h"
+#include "render.h"
+#include "scenes.h"
+
+// Render the built in scenes deterministically a few times each, at a few
+// thread counts, and write the timings out as JSON so throughput can be
+// compared between builds on the same machine.
+//
+// usage: benchmark [--spp n] [--rows n] [--repeats n] [--warmup n]
+//                  [--seed n] [--threads a,b,...] [--scenes a,b,...]
+//                  [--out path]
+#define BENCHMARK_MAX_RUNS 64
+#define BENCHMARK_MAX_THREAD_COUNTS 16
+
+typedef RenderReport (*SceneFunction)(RenderPool *pool, RenderSettings *overrides);
+
+struct BenchmarkScene {
+	const char *name;
+	SceneFunction function;
+};
+
+struct BenchmarkResult {
+	const char *scene;
+	u32 num_threads;
+	u64 ray_count;
+	u64 sample_count;
+	b8 consistent; // same ray count on every run
+	f64 median_seconds;
+	f64 p95_seconds;
+	f64 min_seconds;
+};
+
+inline b8 name_in_list(const char *name, const char *list) {
+	if (list == NULL) {
+		return true;
+	}
+	size_t length = strlen(name);
+	const char *p = list;
+	while (*p) {
+		const char *end = strchr(p, ',');
+		size_t item_length = end ? (size_t) (end - p) : strlen(p);
+		if ((item_length == length) && (strncmp(p, name, length) == 0)) {
+			return true;
+		}
+		if (end == NULL) {
+			break;
+		}
+		p = end + 1;
+	}
+	return false;
+}
+
+// Nearest rank percentile of an ascending list
+inline f64 percentile(f64 *sorted, u32 count, f64 fraction) {
+	u32 rank = (u32) ceil(fraction * count);
+	if (rank < 1) {
+		rank = 1;
+	}
+	return sorted[rank - 1];
+}
+
+inline BenchmarkResult run_scene(
+	BenchmarkScene *scene,
+	RenderPool *pool,
+	RenderSettings *overrides,
+	u32 num_warmup,
+	u32 num_repeats
+) {
+	BenchmarkResult result = {};
+	result.scene = scene->name;
+	result.num_threads = pool->num_threads + 1;
+	result.consistent = true;
+	for (u32 w = 0; w < num_warmup; w++) {
+		scene->function(pool, overrides);
+	}
+	f64 seconds[BENCHMARK_MAX_RUNS];
+	for (u32 r = 0; r < num_repeats; r++) {
+		RenderReport report = scene->function(pool, overrides);
+		seconds[r] = report.seconds;
+		if ((r > 0) && (report.ray_count != result.ray_count)) {
+			result.consistent = false;
+		}
+		result.ray_count = report.ray_count;
+		result.sample_count = report.sample_count;
+	}
+	std::sort(seconds, seconds + num_repeats);
+	result.median_seconds = (num_repeats % 2) ? seconds[num_repeats / 2]
+		: 0.5 * (seconds[num_repeats / 2 - 1] + seconds[num_repeats / 2]);
+	result.p95_seconds = percentile(seconds, num_repeats, 0.95);
+	result.min_seconds = seconds[0];
+	return result;
+}
+
+int main(int argc, char **args) {
+	BenchmarkScene scenes[] = {
+		{"test_spheres", test_spheres},
+		{"random_spheres", random_spheres},
+		{"arasp_9spheres", arasp_9spheres},
+		{"caseym_5spheres", caseym_5spheres},
+	};
+	u32 num_scenes = sizeof(scenes) / sizeof(scenes[0]);
+	RenderSettings overrides = {};
+	overrides.num_samples = 16;
+	overrides.deterministic = true;
+	overrides.quiet = true;
+	overrides.skip_image_write = true;
+	u32 num_warmup = 1;
+	u32 num_repeats = 5;
+	const char *scene_list = NULL;
+	const char *out_path = "benchmark.json";
+	u32 thread_counts[BENCHMARK_MAX_THREAD_COUNTS] = {1, core_count()};
+	u32 num_thread_counts = (core_count() > 1) ? 2 : 1;
+	for (i32 i = 1; i < argc; i++) {
+		b8 has_value = i + 1 < argc;
+		if ((strcmp(args[i], "--spp") == 0) && has_value) {
+			overrides.num_samples = (u32) atoi(args[++i]);
+		} else if ((strcmp(args[i], "--rows") == 0) && has_value) {
+			overrides.image_rows = (u32) atoi(args[++i]);
+		} else if ((strcmp(args[i], "--repeats") == 0) && has_value) {
+			num_repeats = (u32) atoi(args[++i]);
+		} else if ((strcmp(args[i], "--warmup") == 0) && has_value) {
+			num_warmup = (u32) atoi(args[++i]);
+		} else if ((strcmp(args[i], "--seed") == 0) && has_value) {
+			overrides.seed = (u32) strtoul(args[++i], NULL, 10);
+			// 0 would mean DEFAULT_SEED, not the seed asked for
+			if (overrides.seed == 0) {
+				printf("[warn] --seed has to be at least 1\n");
+				return 1;
+			}
+		} else if ((strcmp(args[i], "--scenes") == 0) && has_value) {
+			scene_list = args[++i];
+		} else if ((strcmp(args[i], "--out") == 0) && has_value) {
+			out_path = args[++i];
+		} else if ((strcmp(args[i], "--threads") == 0) && has_value) {
+			num_thread_counts = 0;
+			char *p = args[++i];
+			while (*p && (num_thread_counts < BENCHMARK_MAX_THREAD_COUNTS)) {
+				u32 n = (u32) strtoul(p, &p, 10);
+				if (n > 0) {
+					thread_counts[num_thread_counts++] = n;
+				}
+				if (*p == ',') {
+					p++;
+				} else {
+					break;
+				}
+			}
+		} else {
+			printf("[warn] ignoring argument %s\n", args[i]);
+		}
+	}
+	if (num_repeats < 1) {
+		num_repeats = 1;
+	}
+	if (num_repeats > BENCHMARK_MAX_RUNS) {
+		num_repeats = BENCHMARK_MAX_RUNS;
+	}
+	if (num_thread_counts == 0) {
+		thread_counts[num_thread_counts++] = 1;
+	}
+	BenchmarkResult *results = (BenchmarkResult *) malloc(sizeof(BenchmarkResult) * num_scenes * num_thread_counts);
+	u32 num_results = 0;
+	for (u32 t = 0; t < num_thread_counts; t++) {
+		RenderPool *pool = create_render_pool(thread_counts[t] - 1);
+		for (u32 s = 0; s < num_scenes; s++) {
+			if (!name_in_list(scenes[s].name, scene_list)) {
+				continue;
+			}
+			BenchmarkResult result = run_scene(scenes + s, pool, &overrides, num_warmup, num_repeats);
+			results[num_results++] = result;
+			printf(
+				"[bench] %-16s %3d threads: median %.4f s, p95 %.4f s, %.2f Mrays/s, %.3f rays/sample\n",
+				result.scene,
+				result.num_threads,
+				result.median_seconds,
+				result.p95_seconds,
+				((f64) result.ray_count / 1.0e6) / result.median_seconds,
+				(f64) result.ray_count / (f64) result.sample_count
+			);
+			if (!result.consistent) {
+				printf("[warn] %s did a different amount of work between runs\n", result.scene);
+			}
+		}
+		destroy_render_pool(pool);
+	}
+	FILE *out = fopen(out_path, "w");
+	if (out == NULL) {
+		printf("[warn] could not open %s\n", out_path);
+		free(results);
+		return 1;
+	}
+	fprintf(out, "{\n");
+	fprintf(out, "\t\"spp\": %u,\n", overrides.num_samples);
+	fprintf(out, "\t\"rows\": %u,\n", overrides.image_rows);
+	fprintf(out, "\t\"seed\": %u,\n", overrides.seed ? overrides.seed : DEFAULT_SEED);
+	fprintf(out, "\t\"warmup\": %u,\n", num_warmup);
+	fprintf(out, "\t\"repeats\": %u,\n", num_repeats);
+	fprintf(out, "\t\"cores\": %u,\n", core_count());
+	fprintf(out, "\t\"results\": [\n");
+	for (u32 r = 0; r < num_results; r++) {
+		BenchmarkResult *result = results + r;
+		// scaling is against the same scene at the fewest threads that ran
+		BenchmarkResult *base = result;
+		for (u32 b = 0; b < num_results; b++) {
+			if ((strcmp(results[b].scene, result->scene) == 0) && (results[b].num_threads < base->num_threads)) {
+				base = results + b;
+			}
+		}
+		f64 speedup = base->median_seconds / result->median_seconds;
+		f64 efficiency = speedup * (f64) base->num_threads / (f64) result->num_threads;
+		fprintf(out, "\t\t{\n");
+		fprintf(out, "\t\t\t\"scene\": \"%s\",\n", result->scene);
+		fprintf(out, "\t\t\t\"threads\": %u,\n", result->num_threads);
+		fprintf(out, "\t\t\t\"rays\": %llu,\n", (unsigned long long) result->ray_count);
+		fprintf(out, "\t\t\t\"samples\": %llu,\n", (unsigned long long) result->sample_count);
+		fprintf(out, "\t\t\t\"consistent\": %s,\n", result->consistent ? "true" : "false");
+		fprintf(out, "\t\t\t\"median_seconds\": %.6f,\n", result->median_seconds);
+		fprintf(out, "\t\t\t\"p95_seconds\": %.6f,\n", result->p95_seconds);
+		fprintf(out, "\t\t\t\"min_seconds\": %.6f,\n", result->min_seconds);
+		fprintf(out, "\t\t\t\"mrays_per_second\": %.4f,\n", ((f64) result->ray_count / 1.0e6) / result->median_seconds);
+		fprintf(out, "\t\t\t\"rays_per_sample\": %.4f,\n", (f64) result->ray_count / (f64) result->sample_count);
+		fprintf(out, "\t\t\t\"speedup\": %.4f,\n", speedup);
+		fprintf(out, "\t\t\t\"efficiency\": %.4f\n", efficiency);
+		fprintf(out, "\t\t}%s\n", (r + 1 < num_results) ? "," : "");
+	}
+	fprintf(out, "\t]\n");
+	fprintf(out, "}\n");
+	fclose(out);
+	printf("[ok] wrote %s\n", out_path);
+	free(results);
+	return 0;
+}
@@ -0,0 +1,388 @@
+#ifndef YELLOW_BVH
+#define YELLOW_BVH
+#include <cmath>
+#include <cfloat>
+#include <cstdlib>
+#include <algorithm>
+#include "types.h"
+#include "linalg.h"
+#include "materials.h"
+#include "lights.h"
+
+// NOTE(dd): binned SAH build, see PBRT 4.3
+#define BVH_BUCKET_COUNT 16
+#define BVH_MAX_LEAF_SIZE 4
+// past this depth we stop evaluating the SAH and just split at the median,
+// which bounds the traversal stack
+#define BVH_MAX_SAH_DEPTH 64
+#define BVH_STACK_SIZE 128
+// wide nodes are collapsed from the binary hierarchy, four children each
+#define WIDE_BVH_WIDTH 4
+#define WIDE_BVH_STACK_SIZE (3 * BVH_STACK_SIZE)
+// below this many spheres the flat SIMD loop beats walking a hierarchy
+#define BVH_MIN_SPHERES 64
+
+struct AABB {
+	Point3D min;
+	Point3D max;
+};
+
+struct BVHNode {
+	AABB bounds;
+	u32 offset; // first sphere for leaves, second child for interior nodes
+	u16 count; // number of spheres, 0 for interior nodes
+	u16 axis;
+};
+
+struct BVH {
+	u32 num_nodes;
+	u32 num_spheres;
+	BVHNode *nodes;
+	Sphere *spheres; // reordered copy so leaves are contiguous
+};
+
+// Child bounds are stored as [min/max][axis][child] so one SIMD register
+// holds the same plane of every child. Empty slots get inverted bounds,
+// which always miss when the near plane is picked by the ray direction sign.
+struct WideBVHNode {
+	f32 bounds[2][3][WIDE_BVH_WIDTH];
+	u32 child[WIDE_BVH_WIDTH]; // first sphere for leaves, node index otherwise
+	u16 count[WIDE_BVH_WIDTH]; // number of spheres, 0 for interior children
+};
+
+struct WideBVH {
+	u32 num_nodes;
+	u32 num_spheres;
+	WideBVHNode *nodes;
+	Sphere *spheres; // shared with the binary hierarchy it was collapsed from
+};
+
+struct BVHBuildPrimitive {
+	AABB bounds;
+	Point3D centroid;
+	u32 index;
+};
+
+struct BVHBucket {
+	AABB bounds;
+	u32 count;
+};
+
+inline AABB empty_aabb() {
+	return (AABB) {{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
+}
+
+inline AABB aabb_union(AABB *a, AABB *b) {
+	AABB c = {
+		{fminf(a->min.x, b->min.x), fminf(a->min.y, b->min.y), fminf(a->min.z, b->min.z)},
+		{fmaxf(a->max.x, b->max.x), fmaxf(a->max.y, b->max.y), fmaxf(a->max.z, b->max.z)}
+	};
+	return c;
+}
+
+inline AABB aabb_include(AABB *a, Point3D *p) {
+	AABB c = {
+		{fminf(a->min.x, p->x), fminf(a->min.y, p->y), fminf(a->min.z, p->z)},
+		{fmaxf(a->max.x, p->x), fmaxf(a->max.y, p->y), fmaxf(a->max.z, p->z)}
+	};
+	return c;
+}
+
+inline f32 aabb_surface_area(AABB *a) {
+	Vec3D extent = a->max - a->min;
+	if ((extent.x < 0.0) || (extent.y < 0.0) || (extent.z < 0.0)) {
+		return 0.0;
+	}
+	return 2.0 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+inline f32 vec_component(Vec3D *a, u32 axis) {
+	return (axis == 0) ? a->x : ((axis == 1) ? a->y : a->z);
+}
+
+inline AABB sphere_bounds(Sphere *sphere) {
+	// NOTE(dd): negative radii are used for hollow glass, so bound on |r|
+	f32 r = fabsf(sphere->radius);
+	Point3D o = sphere->origin;
+	return (AABB) {{o.x - r, o.y - r, o.z - r}, {o.x + r, o.y + r, o.z + r}};
+}
+
+inline u32 sah_bucket(Point3D *centroid, AABB *centroid_bounds, u32 axis) {
+	f32 lo = vec_component(&centroid_bounds->min, axis);
+	f32 hi = vec_component(&centroid_bounds->max, axis);
+	f32 c = vec_component(centroid, axis);
+	u32 b = (u32) (BVH_BUCKET_COUNT * ((c - lo) / (hi - lo)));
+	if (b >= BVH_BUCKET_COUNT) {
+		b = BVH_BUCKET_COUNT - 1;
+	}
+	return b;
+}
+
+inline u32 partition_primitives(
+	BVHBuildPrimitive *primitives,
+	u32 start,
+	u32 end,
+	AABB *centroid_bounds,
+	u32 axis,
+	u32 split_bucket
+) {
+	u32 mid = start;
+	for (u32 i = start; i < end; i++) {
+		if (sah_bucket(&primitives[i].centroid, centroid_bounds, axis) <= split_bucket) {
+			BVHBuildPrimitive tmp = primitives[mid];
+			primitives[mid] = primitives[i];
+			primitives[i] = tmp;
+			mid++;
+		}
+	}
+	return mid;
+}
+
+// reorder so that primitives[mid] has the median centroid along axis
+inline void partition_median(BVHBuildPrimitive *primitives, u32 start, u32 end, u32 mid, u32 axis) {
+	std::nth_element(
+		primitives + start,
+		primitives + mid,
+		primitives + end,
+		[axis](BVHBuildPrimitive &a, BVHBuildPrimitive &b) {
+			return vec_component(&a.centroid, axis) < vec_component(&b.centroid, axis);
+		}
+	);
+}
+
+inline u32 make_bvh_leaf(BVH *bvh, BVHBuildPrimitive *primitives, u32 start, u32 end, AABB *bounds, Sphere *spheres) {
+	u32 node_index = bvh->num_nodes++;
+	BVHNode *node = bvh->nodes + node_index;
+	node->bounds = *bounds;
+	node->offset = start;
+	node->count = (u16) (end - start);
+	node->axis = 0;
+	for (u32 i = start; i < end; i++) {
+		bvh->spheres[i] = spheres[primitives[i].index];
+	}
+	return node_index;
+}
+
+inline u32 build_bvh_node(
+	BVH *bvh,
+	BVHBuildPrimitive *primitives,
+	u32 start,
+	u32 end,
+	u32 depth,
+	Sphere *spheres
+) {
+	u32 count = end - start;
+	AABB bounds = empty_aabb();
+	AABB centroid_bounds = empty_aabb();
+	for (u32 i = start; i < end; i++) {
+		bounds = aabb_union(&bounds, &primitives[i].bounds);
+		centroid_bounds = aabb_include(&centroid_bounds, &primitives[i].centroid);
+	}
+	if (count == 1) {
+		return make_bvh_leaf(bvh, primitives, start, end, &bounds, spheres);
+	}
+	Vec3D extent = centroid_bounds.max - centroid_bounds.min;
+	u32 axis = 0;
+	if ((extent.y > extent.x) && (extent.y >= extent.z)) {
+		axis = 1;
+	} else if ((extent.z > extent.x) && (extent.z > extent.y)) {
+		axis = 2;
+	}
+	f32 axis_extent = vec_component(&extent, axis);
+	u32 mid = start + (count / 2);
+	if (axis_extent <= 0.0) {
+		// all centroids coincide, nothing to gain from splitting
+		if (count <= BVH_MAX_LEAF_SIZE) {
+			return make_bvh_leaf(bvh, primitives, start, end, &bounds, spheres);
+		}
+	} else if (depth >= BVH_MAX_SAH_DEPTH) {
+		partition_median(primitives, start, end, mid, axis);
+	} else {
+		BVHBucket buckets[BVH_BUCKET_COUNT];
+		for (u32 b = 0; b < BVH_BUCKET_COUNT; b++) {
+			buckets[b].bounds = empty_aabb();
+			buckets[b].count = 0;
+		}
+		for (u32 i = start; i < end; i++) {
+			u32 b = sah_bucket(&primitives[i].centroid, &centroid_bounds, axis);
+			buckets[b].count++;
+			buckets[b].bounds = aabb_union(&buckets[b].bounds, &primitives[i].bounds);
+		}
+		// sweep from the right to get the cost of every right-hand side,
+		// then from the left to finish the sum
+		f32 right_costs[BVH_BUCKET_COUNT - 1];
+		AABB right_bounds = empty_aabb();
+		u32 right_count = 0;
+		for (u32 b = BVH_BUCKET_COUNT - 1; b > 0; b--) {
+			right_bounds = aabb_union(&right_bounds, &buckets[b].bounds);
+			right_count += buckets[b].count;
+			right_costs[b - 1] = right_count * aabb_surface_area(&right_bounds);
+		}
+		AABB left_bounds = empty_aabb();
+		u32 left_count = 0;
+		u32 best_bucket = 0;
+		f32 best_cost = FLT_MAX;
+		for (u32 b = 0; b < BVH_BUCKET_COUNT - 1; b++) {
+			left_bounds = aabb_union(&left_bounds, &buckets[b].bounds);
+			left_count += buckets[b].count;
+			f32 cost = left_count * aabb_surface_area(&left_bounds) + right_costs[b];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_bucket = b;
+			}
+		}
+		// traversal step costs 1/8 of a sphere test, normalized by parent area
+		f32 leaf_cost = (f32) count;
+		f32 split_cost = 0.125 + best_cost / aabb_surface_area(&bounds);
+		if ((count <= BVH_MAX_LEAF_SIZE) && (leaf_cost <= split_cost)) {
+			return make_bvh_leaf(bvh, primitives, start, end, &bounds, spheres);
+		}
+		mid = partition_primitives(primitives, start, end, &centroid_bounds, axis, best_bucket);
+	}
+	u32 node_index = bvh->num_nodes++;
+	u32 left = build_bvh_node(bvh, primitives, start, mid, depth + 1, spheres);
+	u32 right = build_bvh_node(bvh, primitives, mid, end, depth + 1, spheres);
+	BVHNode *node = bvh->nodes + node_index;
+	node->bounds = aabb_union(&bvh->nodes[left].bounds, &bvh->nodes[right].bounds);
+	node->offset = right;
+	node->count = 0;
+	node->axis = (u16) axis;
+	return node_index;
+}
+
+inline BVH *build_bvh(Sphere *spheres, u32 num_spheres) {
+	BVH *bvh = (BVH *) malloc(sizeof(BVH));
+	bvh->num_nodes = 0;
+	bvh->num_spheres = num_spheres;
+	bvh->nodes = (BVHNode *) malloc(sizeof(BVHNode) * (2 * num_spheres - 1));
+	bvh->spheres = (Sphere *) malloc(sizeof(Sphere) * num_spheres);
+	BVHBuildPrimitive *primitives = (BVHBuildPrimitive *) malloc(sizeof(BVHBuildPrimitive) * num_spheres);
+	for (u32 i = 0; i < num_spheres; i++) {
+		primitives[i].bounds = sphere_bounds(&spheres[i]);
+		primitives[i].centroid = spheres[i].origin;
+		primitives[i].index = i;
+	}
+	build_bvh_node(bvh, primitives, 0, num_spheres, 0, spheres);
+	free(primitives);
+	return bvh;
+}
+
+inline void set_wide_child_bounds(WideBVHNode *node, u32 slot, AABB *bounds) {
+	node->bounds[0][0][slot] = bounds->min.x;
+	node->bounds[0][1][slot] = bounds->min.y;
+	node->bounds[0][2][slot] = bounds->min.z;
+	node->bounds[1][0][slot] = bounds->max.x;
+	node->bounds[1][1][slot] = bounds->max.y;
+	node->bounds[1][2][slot] = bounds->max.z;
+}
+
+inline u32 collapse_bvh_node(WideBVH *wide, BVH *bvh, u32 binary_index) {
+	// open up the largest interior child until we have four slots
+	u32 slots[WIDE_BVH_WIDTH];
+	u32 num_slots = 0;
+	BVHNode *root = bvh->nodes + binary_index;
+	if (root->count > 0) {
+		slots[num_slots++] = binary_index;
+	} else {
+		slots[num_slots++] = binary_index + 1;
+		slots[num_slots++] = root->offset;
+	}
+	while (num_slots < WIDE_BVH_WIDTH) {
+		i32 best_slot = -1;
+		f32 best_area = -1.0;
+		for (u32 i = 0; i < num_slots; i++) {
+			BVHNode *node = bvh->nodes + slots[i];
+			f32 area = aabb_surface_area(&node->bounds);
+			if ((node->count == 0) && (area > best_area)) {
+				best_area = area;
+				best_slot = (i32) i;
+			}
+		}
+		if (best_slot < 0) {
+			break;
+		}
+		BVHNode *opened = bvh->nodes + slots[best_slot];
+		slots[best_slot] = slots[best_slot] + 1;
+		slots[num_slots++] = opened->offset;
+	}
+	u32 wide_index = wide->num_nodes++;
+	AABB empty = empty_aabb();
+	for (u32 i = 0; i < WIDE_BVH_WIDTH; i++) {
+		WideBVHNode *wide_node = wide->nodes + wide_index;
+		if (i >= num_slots) {
+			set_wide_child_bounds(wide_node, i, &empty);
+			wide_node->child[i] = 0;
+			wide_node->count[i] = 0;
+			continue;
+		}
+		BVHNode *node = bvh->nodes + slots[i];
+		set_wide_child_bounds(wide_node, i, &node->bounds);
+		if (node->count > 0) {
+			wide_node->child[i] = node->offset;
+			wide_node->count[i] = node->count;
+		} else {
+			wide_node->child[i] = collapse_bvh_node(wide, bvh, slots[i]);
+			wide_node->count[i] = 0;
+		}
+	}
+	return wide_index;
+}
+
+inline WideBVH *build_wide_bvh(BVH *bvh) {
+	WideBVH *wide = (WideBVH *) malloc(sizeof(WideBVH));
+	wide->num_nodes = 0;
+	wide->num_spheres = bvh->num_spheres;
+	// every wide node consumes at least one binary interior node
+	wide->nodes = (WideBVHNode *) malloc(sizeof(WideBVHNode) * bvh->num_nodes);
+	wide->spheres = bvh->spheres;
+	collapse_bvh_node(wide, bvh, 0);
+	return wide;
+}
+
+inline void free_wide_bvh(WideBVH *wide) {
+	free(wide->nodes);
+	free(wide);
+}
+
+inline void free_bvh(BVH *bvh) {
+	free(bvh->nodes);
+	free(bvh->spheres);
+	free(bvh);
+}
+
+// Undo prepare_world, leaving the scene's own spheres and materials alone
+inline void release_world(World *world) {
+	free(world->lights);
+	if (world->sphere_soa) {
+		free_sphere_soa(world->sphere_soa);
+	}
+	if (world->wide_bvh) {
+		free_wide_bvh(world->wide_bvh);
+	}
+	if (world->bvh) {
+		free_bvh(world->bvh);
+	}
+	world->num_lights = 0;
+	world->lights = NULL;
+	world->sphere_soa = NULL;
+	world->wide_bvh = NULL;
+	world->bvh = NULL;
+}
+
+// Build whatever acceleration structures the world is missing
+inline void prepare_world(World *world) {
+	if (world->lights == NULL) {
+		build_light_list(world);
+	}
+	if (world->num_spheres >= BVH_MIN_SPHERES) {
+		if (world->bvh == NULL) {
+			world->bvh = build_bvh(world->spheres, world->num_spheres);
+		}
+		if (world->wide_bvh == NULL) {
+			world->wide_bvh = build_wide_bvh(world->bvh);
+		}
+	} else if ((world->sphere_soa == NULL) && (world->num_spheres > 0)) {
+		world->sphere_soa = build_sphere_soa(world->spheres, world->num_spheres);
+	}
+}
+#endif //YELLOW_BVH
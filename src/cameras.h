@@ -27,6 +27,19 @@ struct Camera {
 	f32 focal_distance;
 };
 
+// Everything prime_ray needs that doesn't change from sample to sample,
+// worked out once per render. Directions are relative to the camera origin
+// and pixel steps are already scaled by the focal distance.
+struct PreparedCamera {
+	Point3D origin;
+	Vec3D pixel_origin; // through the top left corner of pixel (0, 0)
+	Vec3D pixel_right; // one column to the right
+	Vec3D pixel_down; // one row down
+	Vec3D lens_right; // lens radius along the image plane's horizontal
+	Vec3D lens_up;
+	f32 lens_radius;
+};
+
 inline ImagePlane create_image_plane(f32 fov, f32 aspect_ratio, u32 pixel_height) {
 	ImagePlane image_plane = {};
 	f32 fov_radians = fov * (M_PI / 180.0);
@@ -40,6 +53,24 @@ inline ImagePlane create_image_plane(f32 fov, f32 aspect_ratio, u32 pixel_height
 	return image_plane;
 }
 
+inline PreparedCamera prepare_camera(Camera *camera) {
+	PreparedCamera prepared = {};
+	Vec3D basis1 = cross(&camera->up, &camera->normal);
+	basis1 = normalize(&basis1);
+	Vec3D basis2 = cross(&camera->normal, &basis1);
+	ImagePlane *image_plane = &camera->image_plane;
+	Vec3D horizontal = camera->focal_distance * image_plane->width * basis1;
+	Vec3D vertical = camera->focal_distance * image_plane->height * basis2;
+	prepared.origin = camera->origin;
+	prepared.pixel_origin = (vertical / 2.0) - (horizontal / 2.0) - (camera->focal_distance * camera->normal);
+	prepared.pixel_right = horizontal / (f32) image_plane->cols;
+	prepared.pixel_down = -vertical / (f32) image_plane->rows;
+	prepared.lens_radius = camera->aperture / 2.0;
+	prepared.lens_right = prepared.lens_radius * basis1;
+	prepared.lens_up = prepared.lens_radius * basis2;
+	return prepared;
+}
+
 inline u32* imalloc(size_t rows, size_t cols) {
 	return (u32*) malloc(sizeof(u32) * rows * cols);
 }
@@ -0,0 +1,323 @@
+#ifndef YELLOW_CHECKPOINT
+#define YELLOW_CHECKPOINT
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "types.h"
+#include "colors.h"
+#include "rand.h"
+#include "film.h"
+#include "threads.h"
+#include "writer.h"
+
+// Everything a render needs to pick up where it stopped: the film, how many
+// passes every tile has finished and the tile PRNGs. Workers copy each job
+// they finish into a film kept just for checkpoints, and the writer thread
+// snapshots that one tile at a time under the tile's lock, so a checkpoint
+// never waits for a pass to end and workers only pay for their own tiles.
+// NOTE(dd): raw little endian structs, like the other binary files here
+
+#define CHECKPOINT_PATH "render.checkpoint"
+#define CHECKPOINT_VERSION 2
+
+struct CheckpointHeader {
+	char magic[4]; // "YCKP"
+	u32 version;
+	u32 rows;
+	u32 cols;
+	u32 tile_rows;
+	u32 tile_cols;
+	u32 num_tiles;
+	u32 num_samples;
+	u32 pass_samples;
+	u32 max_depth;
+	u32 seed;
+	u8 deterministic;
+	u8 adaptive;
+	u8 reserved[2];
+	// then sums, counts, means and m2s (if adaptive), then one PRNGState and
+	// one u32 count of finished passes per tile
+};
+
+inline u64 checkpoint_size(CheckpointHeader *header) {
+	u64 num_pixels = (u64) header->rows * header->cols;
+	u64 pixel_size = sizeof(RGBA) + sizeof(u32) + (header->adaptive ? 2 * sizeof(f32) : 0);
+	u64 tile_size = sizeof(PRNGState) + sizeof(u32);
+	return sizeof(CheckpointHeader) + num_pixels * pixel_size + header->num_tiles * tile_size;
+}
+
+// Pointers into a checkpoint laid out in memory
+struct CheckpointView {
+	CheckpointHeader *header;
+	Film film;
+	PRNGState *prng_states;
+	u32 *passes_done;
+};
+
+inline CheckpointView view_checkpoint(u8 *bytes) {
+	CheckpointView view = {};
+	view.header = (CheckpointHeader *) bytes;
+	u64 num_pixels = (u64) view.header->rows * view.header->cols;
+	view.film.rows = view.header->rows;
+	view.film.cols = view.header->cols;
+	u8 *next = bytes + sizeof(CheckpointHeader);
+	view.film.sums = (RGBA *) next;
+	next += num_pixels * sizeof(RGBA);
+	view.film.counts = (u32 *) next;
+	next += num_pixels * sizeof(u32);
+	if (view.header->adaptive) {
+		view.film.means = (f32 *) next;
+		next += num_pixels * sizeof(f32);
+		view.film.m2s = (f32 *) next;
+		next += num_pixels * sizeof(f32);
+	}
+	view.prng_states = (PRNGState *) next;
+	next += view.header->num_tiles * sizeof(PRNGState);
+	view.passes_done = (u32 *) next;
+	return view;
+}
+
+// Where tile t of the grid sits in the image
+inline void checkpoint_tile_bounds(
+	CheckpointHeader *header,
+	u32 t,
+	u32 *row_min,
+	u32 *row_max,
+	u32 *col_min,
+	u32 *col_max
+) {
+	u32 tiles_across = (header->cols + header->tile_cols - 1) / header->tile_cols;
+	*row_min = (t / tiles_across) * header->tile_rows;
+	*col_min = (t % tiles_across) * header->tile_cols;
+	*row_max = (*row_min + header->tile_rows < header->rows) ? *row_min + header->tile_rows : header->rows;
+	*col_max = (*col_min + header->tile_cols < header->cols) ? *col_min + header->tile_cols : header->cols;
+}
+
+// Kept up to date by the workers for as long as the render runs, then
+// handed to the writer with the last checkpoint, which frees it
+struct Checkpoint {
+	CheckpointHeader header;
+	Film film; // every tile as of the last job finished on it
+	// per tile, each under that tile's lock
+	PRNGState *prng_states;
+	u32 *passes_done;
+	u64 *pixels_done; // in the pass being rendered
+	volatile u32 *locks;
+	ImageWriter *writer; // NULL to write on whichever thread finds one due
+	f64 interval;
+	f64 start;
+	volatile u64 last_due; // intervals since start that got a checkpoint
+	volatile u64 copy_nanoseconds; // workers copying jobs in, all of them
+	volatile u64 num_checkpoints;
+	b8 quiet;
+};
+
+// What a checkpoint write carries, since the writer frees it afterwards
+struct CheckpointRequest {
+	Checkpoint *checkpoint;
+	b8 last;
+};
+
+inline Checkpoint *create_checkpoint(CheckpointHeader *header, ImageWriter *writer, f64 interval, b8 quiet) {
+	Checkpoint *checkpoint = (Checkpoint *) calloc(1, sizeof(Checkpoint));
+	checkpoint->header = *header;
+	checkpoint->film = create_film(header->rows, header->cols, header->adaptive);
+	checkpoint->prng_states = (PRNGState *) calloc(header->num_tiles, sizeof(PRNGState));
+	checkpoint->passes_done = (u32 *) calloc(header->num_tiles, sizeof(u32));
+	checkpoint->pixels_done = (u64 *) calloc(header->num_tiles, sizeof(u64));
+	checkpoint->locks = (volatile u32 *) calloc(header->num_tiles, sizeof(u32));
+	checkpoint->writer = writer;
+	checkpoint->interval = interval;
+	checkpoint->start = tick();
+	checkpoint->quiet = quiet;
+	return checkpoint;
+}
+
+inline void free_checkpoint(Checkpoint *checkpoint) {
+	free_film(&checkpoint->film);
+	free(checkpoint->prng_states);
+	free(checkpoint->passes_done);
+	free(checkpoint->pixels_done);
+	free((void *) checkpoint->locks);
+	free(checkpoint);
+}
+
+// Runs on the writer thread: copy every tile out under its lock, then
+// write to a temporary file and rename it over the last checkpoint, so
+// dying half way through never leaves us without one
+inline b8 write_checkpoint_file(ImageWrite *write) {
+	CheckpointRequest *request = (CheckpointRequest *) write->pixels;
+	Checkpoint *checkpoint = request->checkpoint;
+	CheckpointHeader *header = &checkpoint->header;
+	u64 size = checkpoint_size(header);
+	u8 *bytes = (u8 *) malloc(size);
+	memcpy(bytes, header, sizeof(CheckpointHeader));
+	CheckpointView view = view_checkpoint(bytes);
+	for (u32 t = 0; t < header->num_tiles; t++) {
+		u32 row_min, row_max, col_min, col_max;
+		checkpoint_tile_bounds(header, t, &row_min, &row_max, &col_min, &col_max);
+		spin_lock(checkpoint->locks + t);
+		for (u32 i = row_min; i < row_max; i++) {
+			copy_film_row(&view.film, &checkpoint->film, i, col_min, col_max);
+		}
+		view.prng_states[t] = checkpoint->prng_states[t];
+		view.passes_done[t] = checkpoint->passes_done[t];
+		spin_unlock(checkpoint->locks + t);
+	}
+	if (request->last) {
+		free_checkpoint(checkpoint);
+	}
+	char temporary_path[256];
+	snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", write->path);
+	FILE *file = fopen(temporary_path, "wb");
+	b8 ok = file != NULL;
+	if (ok) {
+		ok = fwrite(bytes, 1, size, file) == size;
+		ok = (fclose(file) == 0) && ok;
+#ifdef _WIN32
+		// rename won't replace an existing file on Windows
+		remove(write->path);
+#endif
+		ok = ok && (rename(temporary_path, write->path) == 0);
+	}
+	free(bytes);
+	return ok;
+}
+
+// Queue a checkpoint of whatever the tiles hold by the time the writer gets
+// to it. The last one takes the checkpoint with it, nothing may touch it
+// after.
+inline void submit_checkpoint(Checkpoint *checkpoint, b8 last) {
+	CheckpointRequest *request = (CheckpointRequest *) malloc(sizeof(CheckpointRequest));
+	request->checkpoint = checkpoint;
+	request->last = last;
+	sync_fetch_and_add(&checkpoint->num_checkpoints, 1);
+	CheckpointHeader *header = &checkpoint->header;
+	ImageWrite write = {
+		CHECKPOINT_PATH,
+		IMAGE_FORMAT_BMP,
+		header->rows,
+		header->cols,
+		request,
+		checkpoint->quiet,
+		write_checkpoint_file,
+		NULL
+	};
+	submit_write(checkpoint->writer, write);
+}
+
+// Called by a worker with a job it just finished: copy the job's pixels in,
+// count its tile done with the pass once every job of the tile is, and
+// queue a checkpoint if one is due
+inline void checkpoint_job(Checkpoint *checkpoint, RenderJob *job, Film *film, u32 pass) {
+	f64 start = tick();
+	u32 t = job->tile_index;
+	u32 row_min, row_max, col_min, col_max;
+	checkpoint_tile_bounds(&checkpoint->header, t, &row_min, &row_max, &col_min, &col_max);
+	u64 tile_pixels = (u64) (row_max - row_min) * (col_max - col_min);
+	u64 job_pixels = (u64) (job->row_max - job->row_min) * (job->col_max - job->col_min);
+	spin_lock(checkpoint->locks + t);
+	for (u32 i = job->row_min; i < job->row_max; i++) {
+		copy_film_row(&checkpoint->film, film, i, job->col_min, job->col_max);
+	}
+	checkpoint->prng_states[t] = job->prng_state;
+	checkpoint->pixels_done[t] += job_pixels;
+	if (checkpoint->pixels_done[t] == tile_pixels) {
+		checkpoint->passes_done[t] = pass + 1;
+	}
+	spin_unlock(checkpoint->locks + t);
+	f64 end = tick();
+	sync_fetch_and_add(&checkpoint->copy_nanoseconds, (u64) ((end - start) * 1.0e9));
+	// whoever moves last_due on gets to submit, everyone else carries on
+	u64 due = (u64) ((end - checkpoint->start) / checkpoint->interval);
+	u64 last_due = checkpoint->last_due;
+	if ((due > last_due) && sync_compare_and_swap(&checkpoint->last_due, last_due, due)) {
+		submit_checkpoint(checkpoint, false);
+	}
+}
+
+// Start a new pass, with every tile owing all of its pixels again. Only
+// while no worker is running.
+inline void start_checkpoint_pass(Checkpoint *checkpoint) {
+	for (u32 t = 0; t < checkpoint->header.num_tiles; t++) {
+		spin_lock(checkpoint->locks + t);
+		checkpoint->pixels_done[t] = 0;
+		spin_unlock(checkpoint->locks + t);
+	}
+}
+
+// Read a checkpoint back into film, prng_states and passes_done (num_tiles
+// of each) if it was made for the same image, tiling and sampling as
+// expected. False if nothing was loaded.
+inline b8 load_checkpoint(
+	const char *path,
+	CheckpointHeader *expected,
+	Film *film,
+	PRNGState *prng_states,
+	u32 *passes_done
+) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		printf("[warn] no checkpoint at %s, starting from scratch\n", path);
+		return false;
+	}
+	CheckpointHeader saved = {};
+	b8 ok = fread(&saved, sizeof(CheckpointHeader), 1, file) == 1;
+	ok = ok && (memcmp(saved.magic, "YCKP", 4) == 0) && (saved.version == CHECKPOINT_VERSION);
+	if (!ok) {
+		printf("[warn] %s is not a checkpoint this build can read\n", path);
+		fclose(file);
+		return false;
+	}
+	b8 same_image = (saved.rows == expected->rows)
+		&& (saved.cols == expected->cols)
+		&& (saved.tile_rows == expected->tile_rows)
+		&& (saved.tile_cols == expected->tile_cols);
+	b8 same_sampling = (saved.num_samples == expected->num_samples)
+		&& (saved.pass_samples == expected->pass_samples)
+		&& (saved.max_depth == expected->max_depth)
+		&& (saved.adaptive == expected->adaptive)
+		&& (saved.deterministic == expected->deterministic)
+		&& (!saved.deterministic || (saved.seed == expected->seed));
+	if (!same_image || !same_sampling) {
+		printf(
+			"[warn] checkpoint is for a %ux%u image with %ux%u tiles, %u samples in passes of %u, depth %u%s%s",
+			saved.cols,
+			saved.rows,
+			saved.tile_cols,
+			saved.tile_rows,
+			saved.num_samples,
+			saved.pass_samples,
+			saved.max_depth,
+			saved.adaptive ? ", adaptive" : "",
+			saved.deterministic ? ", deterministic with seed " : ""
+		);
+		if (saved.deterministic) {
+			printf("%u", saved.seed);
+		}
+		printf(", starting from scratch\n");
+		fclose(file);
+		return false;
+	}
+	size_t num_pixels = (size_t) saved.rows * saved.cols;
+	ok = fread(film->sums, sizeof(RGBA), num_pixels, file) == num_pixels;
+	ok = ok && (fread(film->counts, sizeof(u32), num_pixels, file) == num_pixels);
+	if (saved.adaptive) {
+		ok = ok && (fread(film->means, sizeof(f32), num_pixels, file) == num_pixels);
+		ok = ok && (fread(film->m2s, sizeof(f32), num_pixels, file) == num_pixels);
+	}
+	ok = ok && (fread(prng_states, sizeof(PRNGState), saved.num_tiles, file) == saved.num_tiles);
+	ok = ok && (fread(passes_done, sizeof(u32), saved.num_tiles, file) == saved.num_tiles);
+	fclose(file);
+	if (!ok) {
+		printf("[warn] checkpoint %s is cut short, starting from scratch\n", path);
+		memset(film->sums, 0, num_pixels * sizeof(RGBA));
+		memset(film->counts, 0, num_pixels * sizeof(u32));
+		if (saved.adaptive) {
+			memset(film->means, 0, num_pixels * sizeof(f32));
+			memset(film->m2s, 0, num_pixels * sizeof(f32));
+		}
+	}
+	return ok;
+}
+#endif //YELLOW_CHECKPOINT
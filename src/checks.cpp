@@ -0,0 +1,494 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "types.h"
+#include "rand.h"
+#include "linalg.h"
+#include "colors.h"
+#include "materials.h"
+#include "threads.h"
+#include "ray.h"
+#include "bvh.h"
+#include "render.h"
+#include "scenes.h"
+#include "files.h"
+
+// Behaviour checks: every fast path against a slow one that's easy to
+// trust, and renders that have to come out identical. Prints [ok] or
+// [fail] per check and exits with 1 if any failed. Renders write their
+// images to the working directory.
+#define CHECKS_SEED 7654321
+#define CHECKS_NUM_RAYS (1 << 14)
+#define CHECKS_EXTENT 10.0
+// relative difference in hit distance put down to rounding
+#define CHECKS_DISTANCE_TOLERANCE 1e-4
+// light sampling against plain path tracing, compared in blocks of pixels
+#define CHECKS_CONVERGENCE_ROWS 16
+#define CHECKS_CONVERGENCE_BLOCK 4
+#define CHECKS_CONVERGENCE_SAMPLES 2048
+// standard errors two estimates of the same block may be apart
+#define CHECKS_CONVERGENCE_MAX_Z 5.0
+
+struct Checks {
+	u32 num_run;
+	u32 num_failed;
+};
+
+inline void report_check(Checks *checks, const char *name, b8 ok, const char *detail) {
+	checks->num_run++;
+	if (!ok) {
+		checks->num_failed++;
+	}
+	printf("[%s] %s: %s\n", ok ? "ok" : "fail", name, detail);
+}
+
+// Spheres of mixed sizes scattered through a box, so some overlap and some
+// are nested, over a ground plane
+inline World make_check_world(PRNGState *prng_state, u32 num_spheres, Material *materials, u32 num_materials) {
+	World world = {};
+	world.num_materials = num_materials;
+	world.materials = materials;
+	world.num_spheres = num_spheres;
+	world.spheres = (Sphere *) malloc(sizeof(Sphere) * num_spheres);
+	f32 e = CHECKS_EXTENT;
+	for (u32 i = 0; i < num_spheres; i++) {
+		Sphere *sphere = world.spheres + i;
+		sphere->origin = (Point3D) {uniform(prng_state, -e, e), uniform(prng_state, -e, e), uniform(prng_state, -e, e)};
+		sphere->radius = (unit_uniform(prng_state) < 0.1) ? uniform(prng_state, 1.0, 4.0) : uniform(prng_state, 0.05, 0.5);
+		sphere->material_index = i % num_materials;
+	}
+	world.num_planes = 1;
+	world.planes = (Plane *) malloc(sizeof(Plane));
+	world.planes[0].normal = (Vec3D) {0.0, 1.0, 0.0};
+	world.planes[0].distance = e;
+	world.planes[0].material_index = 0;
+	return world;
+}
+
+// Rays from inside and around the box in every direction, with a random
+// distance to test occlusion up to
+inline void make_check_rays(PRNGState *prng_state, Ray *rays, f32 *t_max, u32 count) {
+	f32 e = 2.0 * CHECKS_EXTENT;
+	for (u32 i = 0; i < count; i++) {
+		Point3D origin = {uniform(prng_state, -e, e), uniform(prng_state, -e, e), uniform(prng_state, -e, e)};
+		rays[i] = (Ray) {origin, random_unit_vector(prng_state) * uniform(prng_state, 0.5, 2.0)};
+		t_max[i] = uniform(prng_state, 0.0, 2.0 * e);
+	}
+}
+
+inline f32 hit_distance(Ray *ray, Intersection *intersection) {
+	Vec3D offset = intersection->origin - ray->origin;
+	return l2_norm(&offset) / l2_norm(&ray->direction);
+}
+
+// Count the rays where find_intersection and occluded on world disagree
+// with the plain loop over every sphere on linear, which must be the same
+// scene with nothing built. Hits at the same distance, give or take
+// rounding, may be on different spheres where two of them touch.
+inline u32 count_mismatches(World *world, World *linear, Ray *rays, f32 *t_max, u32 count) {
+	u32 num_mismatches = 0;
+	for (u32 i = 0; i < count; i++) {
+		Ray *ray = rays + i;
+		Intersection expected = find_intersection(ray, linear);
+		Intersection found = find_intersection(ray, world);
+		f32 expected_distance = expected.intersected ? hit_distance(ray, &expected) : 0.0;
+		f32 tolerance = CHECKS_DISTANCE_TOLERANCE * fmax(1.0, expected_distance);
+		b8 same = expected.intersected == found.intersected;
+		if (same && expected.intersected) {
+			f32 found_distance = hit_distance(ray, &found);
+			same = fabs(found_distance - expected_distance) <= tolerance;
+		}
+		// occlusion right at t_max is down to rounding too
+		b8 borderline = expected.intersected && (fabs(expected_distance - t_max[i]) <= tolerance);
+		if (!borderline && (occluded(ray, linear, t_max[i]) != occluded(ray, world, t_max[i]))) {
+			same = false;
+		}
+		if (!same) {
+			num_mismatches++;
+		}
+	}
+	return num_mismatches;
+}
+
+// find_intersection and occluded through an acceleration structure, built
+// by build, against the plain loop at a few scene sizes
+typedef void (*BuildFunction)(World *world);
+
+inline void check_intersections(Checks *checks, const char *name, BuildFunction build, PRNGState *prng_state) {
+	Material materials[3] = {};
+	u32 sizes[] = {1, 7, 100, 3000};
+	Ray *rays = (Ray *) malloc(sizeof(Ray) * CHECKS_NUM_RAYS);
+	f32 *t_max = (f32 *) malloc(sizeof(f32) * CHECKS_NUM_RAYS);
+	for (u32 s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		World linear = make_check_world(prng_state, sizes[s], materials, 3);
+		World world = linear;
+		build(&world);
+		make_check_rays(prng_state, rays, t_max, CHECKS_NUM_RAYS);
+		u32 num_mismatches = count_mismatches(&world, &linear, rays, t_max, CHECKS_NUM_RAYS);
+		char check_name[64];
+		char detail[64];
+		snprintf(check_name, sizeof(check_name), "%s/%u spheres", name, sizes[s]);
+		snprintf(detail, sizeof(detail), "%u of %u rays differ from the linear loop", num_mismatches, CHECKS_NUM_RAYS);
+		report_check(checks, check_name, num_mismatches == 0, detail);
+		release_world(&world);
+		free(linear.spheres);
+		free(linear.planes);
+	}
+	free(t_max);
+	free(rays);
+}
+
+inline void build_binary_bvh(World *world) {
+	world->bvh = build_bvh(world->spheres, world->num_spheres);
+}
+
+// NOTE(dd): the AVX2 kernel when built with -march=native on a CPU that
+// has it, the scalar structure of arrays loop otherwise
+inline void build_soa(World *world) {
+	world->sphere_soa = build_sphere_soa(world->spheres, world->num_spheres);
+}
+
+inline void build_wide(World *world) {
+	world->bvh = build_bvh(world->spheres, world->num_spheres);
+	world->wide_bvh = build_wide_bvh(world->bvh);
+}
+
+// Sum and sum of squares of the luminance of every sample in a block
+struct BlockEstimate {
+	f64 sum;
+	f64 sum_squared;
+	u64 count;
+};
+
+inline void estimate_blocks(
+	World *world,
+	PreparedCamera *camera,
+	RGBA *background,
+	RenderSettings *settings,
+	PRNGState *prng_state,
+	BlockEstimate *blocks
+) {
+	u32 rows = CHECKS_CONVERGENCE_ROWS;
+	u32 blocks_across = rows / CHECKS_CONVERGENCE_BLOCK;
+	for (u32 i = 0; i < rows; i++) {
+		for (u32 j = 0; j < rows; j++) {
+			BlockEstimate *block = blocks + (i / CHECKS_CONVERGENCE_BLOCK) * blocks_across + (j / CHECKS_CONVERGENCE_BLOCK);
+			for (u32 s = 0; s < CHECKS_CONVERGENCE_SAMPLES; s++) {
+				f32 row = (f32) i + unit_uniform(prng_state);
+				f32 col = (f32) j + unit_uniform(prng_state);
+				Ray ray = prime_ray(prng_state, camera, row, col, NULL);
+				u32 num_traced_rays = 0;
+				u32 num_segments = 0;
+				RGBA color = trace(prng_state, background, &ray, world, settings, &num_traced_rays, &num_segments, settings->max_depth, NULL);
+				f64 y = luminance(&color);
+				block->sum += y;
+				block->sum_squared += y * y;
+				block->count++;
+			}
+		}
+	}
+}
+
+// Next event estimation with MIS has to converge to the same image as plain
+// path tracing. Both assume a cosine distributed diffuse bounce, so this
+// catches the bounce and the pdfs drifting apart as well as bad weights.
+inline void check_light_sampling(Checks *checks, PRNGState *prng_state) {
+	Material materials[3] = {};
+	materials[0].color = (RGBA) {0.8, 0.8, 0.8, 1.0};
+	materials[0].scatter_index = 1.0;
+	materials[1].color = (RGBA) {0.8, 0.3, 0.3, 1.0};
+	materials[1].scatter_index = 1.0;
+	materials[2].color = (RGBA) {1.0, 1.0, 1.0, 1.0};
+	materials[2].emit = (RGBA) {8.0, 8.0, 8.0, 1.0};
+	materials[2].scatter_index = 1.0;
+	Sphere spheres[3] = {
+		{(Point3D) {0.0, -100.5, -1.0}, 100.0, 0},
+		{(Point3D) {0.0, 0.0, -1.0}, 0.5, 1},
+		{(Point3D) {1.0, 1.0, -0.5}, 0.3, 2},
+	};
+	World world = {};
+	world.num_materials = 3;
+	world.materials = materials;
+	world.num_spheres = 3;
+	world.spheres = spheres;
+	prepare_world(&world);
+	RGBA background = {0.2, 0.2, 0.3, 1.0};
+	Point3D origin = {0.0, 0.5, 1.5};
+	Point3D target = {0.0, 0.0, -1.0};
+	Vec3D normal = origin - target;
+	normal = normalize(&normal);
+	Camera camera = {origin, normal, (Vec3D) {0.0, 1.0, 0.0}, create_image_plane(60.0, 1.0, CHECKS_CONVERGENCE_ROWS), 0.0, 1.0};
+	PreparedCamera prepared = prepare_camera(&camera);
+	RenderSettings settings = {};
+	settings.max_depth = 16;
+	u32 blocks_across = CHECKS_CONVERGENCE_ROWS / CHECKS_CONVERGENCE_BLOCK;
+	u32 num_blocks = blocks_across * blocks_across;
+	BlockEstimate *plain = (BlockEstimate *) calloc(num_blocks, sizeof(BlockEstimate));
+	BlockEstimate *sampled = (BlockEstimate *) calloc(num_blocks, sizeof(BlockEstimate));
+	estimate_blocks(&world, &prepared, &background, &settings, prng_state, plain);
+	settings.light_sampling = true;
+	estimate_blocks(&world, &prepared, &background, &settings, prng_state, sampled);
+	f64 max_z = 0.0;
+	for (u32 b = 0; b < num_blocks; b++) {
+		f64 n = (f64) plain[b].count;
+		f64 plain_mean = plain[b].sum / n;
+		f64 sampled_mean = sampled[b].sum / n;
+		f64 plain_variance = plain[b].sum_squared / n - plain_mean * plain_mean;
+		f64 sampled_variance = sampled[b].sum_squared / n - sampled_mean * sampled_mean;
+		f64 standard_error = sqrt((plain_variance + sampled_variance) / n);
+		if (standard_error > 0.0) {
+			max_z = fmax(max_z, fabs(plain_mean - sampled_mean) / standard_error);
+		}
+	}
+	char detail[96];
+	snprintf(detail, sizeof(detail), "blocks at most %.2f standard errors from plain path tracing", max_z);
+	report_check(checks, "light sampling/convergence", max_z <= CHECKS_CONVERGENCE_MAX_Z, detail);
+	free(sampled);
+	free(plain);
+	release_world(&world);
+}
+
+// Every diffuse and fuzzy bounce and every lens sample draws a point of the
+// unit sphere, so --path-stats has to count at least that many samples
+inline void check_path_stats(Checks *checks, PRNGState *prng_state) {
+	Material materials[2] = {};
+	materials[0].color = (RGBA) {0.8, 0.8, 0.8, 1.0};
+	materials[0].scatter_index = 1.0;
+	materials[1].color = (RGBA) {0.7, 0.6, 0.5, 1.0};
+	materials[1].scatter_index = 0.3;
+	Sphere spheres[2] = {
+		{(Point3D) {0.0, -100.5, -1.0}, 100.0, 0},
+		{(Point3D) {0.0, 0.0, -1.0}, 0.5, 1},
+	};
+	World world = {};
+	world.num_materials = 2;
+	world.materials = materials;
+	world.num_spheres = 2;
+	world.spheres = spheres;
+	prepare_world(&world);
+	RGBA background = {0.5, 0.7, 1.0, 1.0};
+	Point3D origin = {0.0, 0.5, 1.5};
+	Point3D target = {0.0, 0.0, -1.0};
+	Vec3D normal = origin - target;
+	normal = normalize(&normal);
+	Camera camera = {origin, normal, (Vec3D) {0.0, 1.0, 0.0}, create_image_plane(60.0, 1.0, CHECKS_CONVERGENCE_ROWS), 0.1, 2.5};
+	PreparedCamera prepared = prepare_camera(&camera);
+	RenderSettings settings = {};
+	settings.max_depth = 16;
+	PathStats stats = {};
+	u64 num_lens_samples = 0;
+	for (u32 i = 0; i < CHECKS_CONVERGENCE_ROWS; i++) {
+		for (u32 j = 0; j < CHECKS_CONVERGENCE_ROWS; j++) {
+			Ray ray = prime_ray(prng_state, &prepared, (f32) i + 0.5, (f32) j + 0.5, &stats);
+			num_lens_samples++;
+			u32 num_traced_rays = 0;
+			u32 num_segments = 0;
+			trace(prng_state, &background, &ray, &world, &settings, &num_traced_rays, &num_segments, settings.max_depth, &stats);
+		}
+	}
+	u64 num_bounces = stats.events[PATH_EVENT_DIFFUSE] + stats.events[PATH_EVENT_FUZZY];
+	b8 ok = (num_bounces > 0) && (stats.unit_sphere_samples >= num_bounces + num_lens_samples);
+	char detail[128];
+	snprintf(
+		detail,
+		sizeof(detail),
+		"%llu samples counted for %llu diffuse and fuzzy bounces and %llu lens samples",
+		(unsigned long long) stats.unit_sphere_samples,
+		(unsigned long long) num_bounces,
+		(unsigned long long) num_lens_samples
+	);
+	report_check(checks, "path stats/unit sphere samples", ok, detail);
+	release_world(&world);
+}
+
+typedef RenderReport (*SceneFunction)(RenderPool *pool, RenderSettings *overrides);
+
+// Render on num_threads threads, the calling one included, and move the
+// image to path
+inline RenderReport render_check_image(SceneFunction scene, u32 num_threads, RenderSettings *overrides, const char *path) {
+	RenderPool *pool = create_render_pool(num_threads - 1);
+	RenderReport report = scene(pool, overrides);
+	destroy_render_pool(pool);
+	remove(path);
+	rename(image_path(overrides->image_format), path);
+	return report;
+}
+
+inline b8 same_files(const char *a, const char *b) {
+	MappedFile mapped_a;
+	MappedFile mapped_b;
+	if (!map_file(&mapped_a, a)) {
+		return false;
+	}
+	if (!map_file(&mapped_b, b)) {
+		unmap_file(&mapped_a);
+		return false;
+	}
+	b8 same = (mapped_a.size == mapped_b.size) && (memcmp(mapped_a.data, mapped_b.data, mapped_a.size) == 0);
+	unmap_file(&mapped_b);
+	unmap_file(&mapped_a);
+	return same;
+}
+
+// A deterministic render has to give the same bytes and the same ray count
+// however many threads take part, and another seed has to change it
+inline void check_deterministic(Checks *checks) {
+	RenderSettings overrides = {};
+	overrides.num_samples = 16;
+	overrides.image_rows = 60;
+	overrides.deterministic = true;
+	overrides.quiet = true;
+	RenderReport one = render_check_image(test_spheres, 1, &overrides, "check_one_thread.bmp");
+	RenderReport four = render_check_image(test_spheres, 4, &overrides, "check_four_threads.bmp");
+	overrides.seed = 99;
+	render_check_image(test_spheres, 4, &overrides, "check_other_seed.bmp");
+	b8 same_image = same_files("check_one_thread.bmp", "check_four_threads.bmp");
+	b8 same_rays = one.ray_count == four.ray_count;
+	char detail[96];
+	snprintf(
+		detail,
+		sizeof(detail),
+		"1 and 4 threads give %s images and %s ray counts",
+		same_image ? "identical" : "different",
+		same_rays ? "identical" : "different"
+	);
+	report_check(checks, "deterministic/thread count", same_image && same_rays, detail);
+	b8 seed_matters = !same_files("check_four_threads.bmp", "check_other_seed.bmp");
+	report_check(checks, "deterministic/seed", seed_matters, seed_matters ? "another seed changes the image" : "another seed gives the same image");
+}
+
+// Cut a deterministic render short with the time budget, resume it from
+// its checkpoint and compare with the same render done in one go. The two
+// runs have to take exactly the samples of the one, down to the bytes.
+inline void check_resume(Checks *checks, const char *name, RenderSettings *overrides) {
+	overrides->deterministic = true;
+	overrides->quiet = true;
+	overrides->checkpoint_interval = 0.01;
+	RenderReport whole = render_check_image(test_spheres, 2, overrides, "check_whole.bmp");
+	remove(CHECKPOINT_PATH);
+	overrides->time_budget = (f32) (0.4 * whole.seconds);
+	RenderReport cut = render_check_image(test_spheres, 2, overrides, "check_cut.bmp");
+	overrides->time_budget = 0.0;
+	overrides->resume = true;
+	RenderReport resumed = render_check_image(test_spheres, 2, overrides, "check_resumed.bmp");
+	overrides->resume = false;
+	b8 same_image = same_files("check_whole.bmp", "check_resumed.bmp");
+	b8 same_samples = cut.sample_count + resumed.sample_count == whole.sample_count;
+	char check_name[64];
+	char detail[128];
+	snprintf(check_name, sizeof(check_name), "checkpoint/%s", name);
+	snprintf(
+		detail,
+		sizeof(detail),
+		"%llu + %llu resumed samples for %llu in one go, %s image",
+		(unsigned long long) cut.sample_count,
+		(unsigned long long) resumed.sample_count,
+		(unsigned long long) whole.sample_count,
+		same_image ? "identical" : "different"
+	);
+	report_check(checks, check_name, same_image && same_samples, detail);
+}
+
+// A checkpoint made with other settings has to be ignored, so resuming
+// from one for twice the samples renders everything from scratch
+inline void check_resume_mismatch(Checks *checks) {
+	RenderSettings overrides = {};
+	overrides.num_samples = 8;
+	overrides.image_rows = 60;
+	overrides.deterministic = true;
+	overrides.quiet = true;
+	overrides.checkpoint_interval = 0.01;
+	RenderReport whole = render_check_image(test_spheres, 2, &overrides, "check_whole.bmp");
+	overrides.num_samples = 16;
+	overrides.resume = true;
+	RenderReport resumed = render_check_image(test_spheres, 2, &overrides, "check_resumed.bmp");
+	b8 from_scratch = resumed.sample_count == 2 * whole.sample_count;
+	report_check(
+		checks,
+		"checkpoint/other settings",
+		from_scratch,
+		from_scratch ? "ignored, rendered from scratch" : "resumed from a checkpoint for other settings"
+	);
+}
+
+// Like render_check_image, for a scene file
+inline b8 render_scene_file_image(const char *scene_path, u32 num_threads, RenderSettings *overrides, const char *path) {
+	SceneFile scene = {};
+	if (!open_scene_file(&scene, scene_path)) {
+		return false;
+	}
+	RenderPool *pool = create_render_pool(num_threads - 1);
+	scene_file(pool, &scene, overrides);
+	destroy_render_pool(pool);
+	close_scene_file(&scene);
+	remove(path);
+	rename(image_path(overrides->image_format), path);
+	return true;
+}
+
+// A text scene, saved as a binary one while it renders, has to load back
+// as the same scene, bvh and all, and render to the same bytes
+inline void check_scene_file(Checks *checks) {
+	FILE *file = fopen("check_scene.txt", "w");
+	if (file == NULL) {
+		report_check(checks, "scene file/round trip", false, "could not write check_scene.txt");
+		return;
+	}
+	fprintf(file, "camera from 0 2 4 to 0 0 -1 up 0 1 0 fov 40 aperture 0.05 aspect 1.5 rows 60\n");
+	fprintf(file, "background 0.5 0.7 1\n");
+	fprintf(file, "samples 8\n");
+	fprintf(file, "depth 16\n");
+	fprintf(file, "tiles 16 16\n");
+	fprintf(file, "material ground color 0.8 0.8 0.8\n");
+	fprintf(file, "material glass color 1 1 1 scatter 0 refract 1.5\n");
+	fprintf(file, "material metal color 0.7 0.6 0.5 scatter 0.3\n");
+	fprintf(file, "material lamp color 1 1 1 emit 4 4 4\n");
+	fprintf(file, "plane 0 1 0 0.5 ground\n");
+	// enough spheres for a bvh, so it goes through the file too
+	const char *names[] = {"ground", "glass", "metal", "lamp"};
+	for (u32 i = 0; i < 64; i++) {
+		f32 x = -2.0 + 0.5 * (f32) (i % 8);
+		f32 z = -3.0 + 0.5 * (f32) (i / 8);
+		fprintf(file, "sphere %.2f -0.3 %.2f 0.2 %s\n", x, z, names[i % 4]);
+	}
+	fclose(file);
+	RenderSettings overrides = {};
+	overrides.deterministic = true;
+	overrides.quiet = true;
+	overrides.save_scene = "check_scene.scene";
+	remove("check_scene.scene");
+	b8 ok = render_scene_file_image("check_scene.txt", 2, &overrides, "check_text.bmp");
+	overrides.save_scene = NULL;
+	ok = ok && render_scene_file_image("check_scene.scene", 2, &overrides, "check_binary.bmp");
+	b8 same_image = ok && same_files("check_text.bmp", "check_binary.bmp");
+	report_check(
+		checks,
+		"scene file/round trip",
+		same_image,
+		!ok ? "could not load a scene" : (same_image ? "text and saved binary scene render identically" : "text and saved binary scene render differently")
+	);
+}
+
+int main() {
+	PRNGState prng_state = {CHECKS_SEED};
+	warm_up_xor_shift(&prng_state);
+	Checks checks = {};
+	check_intersections(&checks, "bvh", build_binary_bvh, &prng_state);
+	check_intersections(&checks, "soa", build_soa, &prng_state);
+	check_intersections(&checks, "wide_bvh", build_wide, &prng_state);
+	check_light_sampling(&checks, &prng_state);
+	check_path_stats(&checks, &prng_state);
+	check_deterministic(&checks);
+	RenderSettings overrides = {};
+	overrides.num_samples = 64;
+	overrides.image_rows = 60;
+	overrides.tile_rows = 16;
+	overrides.tile_cols = 16;
+	check_resume(&checks, "one pass", &overrides);
+	overrides.progressive = true;
+	check_resume(&checks, "progressive", &overrides);
+	check_resume_mismatch(&checks);
+	check_scene_file(&checks);
+	printf("[info] %u of %u checks failed\n", checks.num_failed, checks.num_run);
+	return (checks.num_failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+#ifndef YELLOW_COUNTERS
+#define YELLOW_COUNTERS
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "types.h"
+#include "threads.h"
+
+// Hardware performance counters, read per worker thread around its tile loop
+// so we can tell whether a change moved us on compute or on memory. Only
+// Linux has them (perf_event_open), everywhere else opening them fails and
+// the render goes on without.
+
+enum PerfCounterKind {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_BRANCH_MISSES,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_FP_OPS,
+	NUM_PERF_COUNTERS
+};
+
+static const char *perf_counter_names[NUM_PERF_COUNTERS] = {
+	"cycles",
+	"instructions",
+	"branch misses",
+	"L1d misses",
+	"LLC misses",
+	"FP ops",
+};
+
+struct alignas(CACHE_LINE_SIZE) PerfCounters {
+	i32 fds[NUM_PERF_COUNTERS]; // -1 when the counter couldn't be opened
+	u64 values[NUM_PERF_COUNTERS]; // summed over every pass
+	b8 available[NUM_PERF_COUNTERS];
+};
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// There is no generic event for floating point work. On Intel since Skylake
+// FP_ARITH_INST_RETIRED (event 0xc7) with every umask bit set counts scalar
+// and packed single and double instructions, elsewhere we set
+// YELLOW_PERF_FP_EVENT to a raw config (e.g. "0xffc7") or go without.
+inline u64 fp_ops_raw_config() {
+	const char *override = getenv("YELLOW_PERF_FP_EVENT");
+	if (override) {
+		return strtoull(override, NULL, 0);
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	u32 eax, ebx, ecx, edx;
+	if (__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+		// "GenuineIntel" comes back in ebx, edx, ecx
+		if ((ebx == 0x756e6547) && (edx == 0x49656e69) && (ecx == 0x6c65746e)) {
+			return 0xffc7;
+		}
+	}
+#endif
+	return 0;
+}
+
+inline i32 open_perf_counter(u32 type, u64 config) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	// when there are more counters than registers the kernel multiplexes
+	// them, and these let us scale the count back up
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// pid 0 and cpu -1 is the calling thread on whatever cpu it runs on
+	return (i32) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Open and start every counter for the calling thread, false if none of
+// them could be opened
+inline b8 start_perf_counters(PerfCounters *counters) {
+	u64 cache_l1d_miss = PERF_COUNT_HW_CACHE_L1D
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	u64 fp_config = fp_ops_raw_config();
+	counters->fds[PERF_CYCLES] = open_perf_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	counters->fds[PERF_INSTRUCTIONS] = open_perf_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	counters->fds[PERF_BRANCH_MISSES] = open_perf_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	counters->fds[PERF_L1D_MISSES] = open_perf_counter(PERF_TYPE_HW_CACHE, cache_l1d_miss);
+	counters->fds[PERF_LLC_MISSES] = open_perf_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	counters->fds[PERF_FP_OPS] = fp_config ? open_perf_counter(PERF_TYPE_RAW, fp_config) : -1;
+	b8 any = false;
+	for (u32 c = 0; c < NUM_PERF_COUNTERS; c++) {
+		if (counters->fds[c] >= 0) {
+			ioctl(counters->fds[c], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters->fds[c], PERF_EVENT_IOC_ENABLE, 0);
+			any = true;
+		}
+	}
+	return any;
+}
+
+// Stop, read and close the calling thread's counters, adding to the totals
+inline void stop_perf_counters(PerfCounters *counters) {
+	for (u32 c = 0; c < NUM_PERF_COUNTERS; c++) {
+		i32 fd = counters->fds[c];
+		if (fd < 0) {
+			continue;
+		}
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		u64 data[3] = {}; // value, time enabled, time running
+		if ((read(fd, data, sizeof(data)) == sizeof(data)) && (data[2] > 0)) {
+			f64 scale = (f64) data[1] / (f64) data[2];
+			counters->values[c] += (u64) ((f64) data[0] * scale);
+			counters->available[c] = true;
+		}
+		close(fd);
+		counters->fds[c] = -1;
+	}
+}
+
+inline const char *perf_counters_unavailable_reason() {
+	if (errno == EACCES || errno == EPERM) {
+		return "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+	}
+	// what perf_event_open says when there's no PMU to count with, which
+	// strerror would make look like a missing file
+	if (errno == ENOENT || errno == ENODEV || errno == EOPNOTSUPP) {
+		return "no hardware counters on this CPU/VM";
+	}
+	return strerror(errno);
+}
+#else // NOT LINUX
+inline b8 start_perf_counters(PerfCounters *counters) {
+	for (u32 c = 0; c < NUM_PERF_COUNTERS; c++) {
+		counters->fds[c] = -1;
+	}
+	return false;
+}
+
+inline void stop_perf_counters(PerfCounters *counters) {
+}
+
+inline const char *perf_counters_unavailable_reason() {
+	return "only supported on Linux";
+}
+#endif
+
+// One slot per worker, workers start and stop their own counters
+inline PerfCounters *create_perf_counters(u32 num_workers) {
+	PerfCounters *counters = (PerfCounters *) cache_aligned_malloc(sizeof(PerfCounters) * num_workers);
+	memset(counters, 0, sizeof(PerfCounters) * num_workers);
+	for (u32 w = 0; w < num_workers; w++) {
+		for (u32 c = 0; c < NUM_PERF_COUNTERS; c++) {
+			counters[w].fds[c] = -1;
+		}
+	}
+	return counters;
+}
+
+inline void print_perf_counters(PerfCounters *counters, u32 num_workers, u64 ray_count) {
+	PerfCounters total = {};
+	for (u32 w = 0; w < num_workers; w++) {
+		for (u32 c = 0; c < NUM_PERF_COUNTERS; c++) {
+			total.values[c] += counters[w].values[c];
+			total.available[c] = total.available[c] || counters[w].available[c];
+		}
+	}
+	if (total.available[PERF_CYCLES] && total.available[PERF_INSTRUCTIONS]) {
+		printf(
+			"[info] %.2f instructions per cycle, %.0f cycles/ray\n",
+			(f64) total.values[PERF_INSTRUCTIONS] / (f64) total.values[PERF_CYCLES],
+			(f64) total.values[PERF_CYCLES] / (f64) ray_count
+		);
+	}
+	for (u32 c = PERF_BRANCH_MISSES; c < NUM_PERF_COUNTERS; c++) {
+		if (total.available[c]) {
+			printf(
+				"[info] %.3f %s/ray (%llu %s)\n",
+				(f64) total.values[c] / (f64) ray_count,
+				perf_counter_names[c],
+				(unsigned long long) total.values[c],
+				perf_counter_names[c]
+			);
+		} else {
+			printf("[info] %s not counted on this machine\n", perf_counter_names[c]);
+		}
+	}
+}
+#endif //YELLOW_COUNTERS
@@ -0,0 +1,160 @@
+#ifndef YELLOW_FILES
+#define YELLOW_FILES
+#include "types.h"
+
+// Just enough file handling for outputs that workers write piece by piece.
+// Writes take an offset so any thread can drop its tile into place without
+// seeking or holding a lock. Inputs are mapped rather than read, so a big
+// file costs nothing until its pages are touched.
+
+#ifdef _WIN32 // WINDOWS
+#include <windows.h>
+
+typedef HANDLE FileHandle;
+#define INVALID_FILE INVALID_HANDLE_VALUE
+
+inline FileHandle create_file(const char *path) {
+	return CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+inline b8 write_at(FileHandle file, u64 offset, const void *data, u64 size) {
+	const u8 *bytes = (const u8 *) data;
+	while (size > 0) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD) offset;
+		overlapped.OffsetHigh = (DWORD) (offset >> 32);
+		DWORD chunk = (size > 0x40000000) ? 0x40000000 : (DWORD) size;
+		DWORD written = 0;
+		if (!WriteFile(file, bytes, chunk, &written, &overlapped) || (written == 0)) {
+			return false;
+		}
+		bytes += written;
+		offset += written;
+		size -= written;
+	}
+	return true;
+}
+
+// Grow (or shrink) the file to size bytes, so the tiles can land in any order
+inline b8 resize_file(FileHandle file, u64 size) {
+	LARGE_INTEGER position;
+	position.QuadPart = (LONGLONG) size;
+	return SetFilePointerEx(file, position, NULL, FILE_BEGIN) && SetEndOfFile(file);
+}
+
+inline void close_file(FileHandle file) {
+	CloseHandle(file);
+}
+
+struct MappedFile {
+	u8 *data;
+	u64 size;
+	HANDLE file;
+	HANDLE mapping;
+};
+
+// Map a whole file copy on write, writes to the pages stay in memory.
+// False if it can't be opened or is empty.
+inline b8 map_file(MappedFile *mapped, const char *path) {
+	*mapped = {};
+	mapped->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mapped->file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mapped->file, &size) || (size.QuadPart == 0)) {
+		CloseHandle(mapped->file);
+		return false;
+	}
+	mapped->size = (u64) size.QuadPart;
+	mapped->mapping = CreateFileMappingA(mapped->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mapped->mapping != NULL) {
+		mapped->data = (u8 *) MapViewOfFile(mapped->mapping, FILE_MAP_COPY, 0, 0, 0);
+	}
+	if (mapped->data == NULL) {
+		if (mapped->mapping != NULL) {
+			CloseHandle(mapped->mapping);
+		}
+		CloseHandle(mapped->file);
+		return false;
+	}
+	return true;
+}
+
+inline void unmap_file(MappedFile *mapped) {
+	UnmapViewOfFile(mapped->data);
+	CloseHandle(mapped->mapping);
+	CloseHandle(mapped->file);
+	*mapped = {};
+}
+#else // UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef i32 FileHandle;
+#define INVALID_FILE -1
+
+inline FileHandle create_file(const char *path) {
+	return open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+}
+
+inline b8 write_at(FileHandle file, u64 offset, const void *data, u64 size) {
+	const u8 *bytes = (const u8 *) data;
+	while (size > 0) {
+		ssize_t written = pwrite(file, bytes, size, (off_t) offset);
+		if (written <= 0) {
+			return false;
+		}
+		bytes += written;
+		offset += written;
+		size -= written;
+	}
+	return true;
+}
+
+// Grow (or shrink) the file to size bytes, so the tiles can land in any order
+inline b8 resize_file(FileHandle file, u64 size) {
+	return ftruncate(file, (off_t) size) == 0;
+}
+
+inline void close_file(FileHandle file) {
+	close(file);
+}
+
+struct MappedFile {
+	u8 *data;
+	u64 size;
+};
+
+// Map a whole file copy on write, writes to the pages stay in memory.
+// False if it can't be opened or is empty.
+inline b8 map_file(MappedFile *mapped, const char *path) {
+	*mapped = {};
+	i32 file = open(path, O_RDONLY);
+	if (file < 0) {
+		return false;
+	}
+	struct stat status;
+	if ((fstat(file, &status) != 0) || (status.st_size == 0)) {
+		close(file);
+		return false;
+	}
+	void *data = mmap(NULL, (size_t) status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+	// NOTE(dd): the mapping keeps the file alive, we don't need the descriptor
+	close(file);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	mapped->data = (u8 *) data;
+	mapped->size = (u64) status.st_size;
+	return true;
+}
+
+inline void unmap_file(MappedFile *mapped) {
+	munmap(mapped->data, (size_t) mapped->size);
+	*mapped = {};
+}
+#endif
+#endif //YELLOW_FILES
@@ -0,0 +1,92 @@
+#ifndef YELLOW_FILM
+#define YELLOW_FILM
+#include <cstdlib>
+#include <cstring>
+#include "types.h"
+#include "colors.h"
+
+// Linear per pixel sums and sample counts, so a render can keep adding
+// samples pass after pass and the image can be resolved at any point
+// in between. A film covers the whole image, or just one tile of it when
+// streaming, and pixel (i, j) of the image lives at film_index(film, i, j).
+struct Film {
+	u32 rows;
+	u32 cols;
+	u32 row_min; // where the film sits in the image, 0 unless it's a tile
+	u32 col_min;
+	RGBA *sums;
+	u32 *counts;
+	// Welford running mean and squared deviations of luminance, carried
+	// between passes for adaptive sampling. NULL when that's off.
+	f32 *means;
+	f32 *m2s;
+};
+
+inline Film create_film(u32 rows, u32 cols, b8 adaptive) {
+	Film film = {};
+	film.rows = rows;
+	film.cols = cols;
+	size_t num_pixels = (size_t) rows * cols;
+	film.sums = (RGBA *) calloc(num_pixels, sizeof(RGBA));
+	film.counts = (u32 *) calloc(num_pixels, sizeof(u32));
+	if (adaptive) {
+		film.means = (f32 *) calloc(num_pixels, sizeof(f32));
+		film.m2s = (f32 *) calloc(num_pixels, sizeof(f32));
+	}
+	return film;
+}
+
+// Film for just the pixels of one tile
+inline Film create_tile_film(u32 row_min, u32 row_max, u32 col_min, u32 col_max, b8 adaptive) {
+	Film film = create_film(row_max - row_min, col_max - col_min, adaptive);
+	film.row_min = row_min;
+	film.col_min = col_min;
+	return film;
+}
+
+inline void free_film(Film *film) {
+	free(film->sums);
+	free(film->counts);
+	free(film->means);
+	free(film->m2s);
+}
+
+inline u64 film_index(Film *film, u32 i, u32 j) {
+	return (u64) (i - film->row_min) * film->cols + (j - film->col_min);
+}
+
+// Copy pixels col_min to col_max of row i between two films that both cover
+// them, with adaptive statistics if from has them
+inline void copy_film_row(Film *to, Film *from, u32 i, u32 col_min, u32 col_max) {
+	u64 to_index = film_index(to, i, col_min);
+	u64 from_index = film_index(from, i, col_min);
+	size_t count = col_max - col_min;
+	memcpy(to->sums + to_index, from->sums + from_index, count * sizeof(RGBA));
+	memcpy(to->counts + to_index, from->counts + from_index, count * sizeof(u32));
+	if (from->means) {
+		memcpy(to->means + to_index, from->means + from_index, count * sizeof(f32));
+		memcpy(to->m2s + to_index, from->m2s + from_index, count * sizeof(f32));
+	}
+}
+
+// Average of everything the pixel has taken so far, black before its first sample
+inline RGBA resolve_pixel(Film *film, u64 index) {
+	u32 count = film->counts[index];
+	if (count == 0) {
+		return (RGBA) {0.0, 0.0, 0.0, 1.0};
+	}
+	return film->sums[index] / (f32) count;
+}
+
+// Resolve rows row_min to row_max, cols col_min to col_max into an image
+// cols wide. Everything that fills in an image goes through here, so the
+// same film always gives the same bytes however it was rendered.
+inline void resolve_film(Film *film, u32 *image, u32 cols, u32 row_min, u32 row_max, u32 col_min, u32 col_max) {
+	for (u32 i = row_min; i < row_max; i++) {
+		for (u32 j = col_min; j < col_max; j++) {
+			RGBA resolved = resolve_pixel(film, film_index(film, i, j));
+			image[(u64) i * cols + j] = rgba_to_u32(&resolved);
+		}
+	}
+}
+#endif //YELLOW_FILM
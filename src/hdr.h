@@ -0,0 +1,205 @@
+#ifndef YELLOW_HDR
+#define YELLOW_HDR
+#include <cstdlib>
+#include <cstring>
+#include "types.h"
+#include "colors.h"
+#include "film.h"
+#include "files.h"
+
+// Linear float copies of the film, straight from the sums before any gamma or
+// clamping, for compositing. The header and layout are written up front so
+// that every pixel has a fixed place in the file and each tile can be written
+// by whichever worker finished it, as soon as it's done.
+// NOTE(dd): both formats are little endian and so is everything we run on,
+// so floats go to disk as they are in memory
+
+enum FloatFormat {
+	FLOAT_FORMAT_NONE,
+	FLOAT_FORMAT_PFM, // portable float map, RGB, bottom row first
+	FLOAT_FORMAT_EXR, // OpenEXR, uncompressed scanlines, float B G R channels
+};
+
+struct FloatImage {
+	FileHandle file;
+	FloatFormat format;
+	u32 rows;
+	u32 cols;
+	u64 data_offset; // first byte after the header (and EXR offset table)
+};
+
+// Appends to a byte buffer big enough for any header we write
+struct HeaderWriter {
+	u8 bytes[512];
+	u32 size;
+};
+
+inline void put_bytes(HeaderWriter *writer, const void *data, u32 size) {
+	memcpy(writer->bytes + writer->size, data, size);
+	writer->size += size;
+}
+
+inline void put_string(HeaderWriter *writer, const char *string) {
+	put_bytes(writer, string, (u32) strlen(string) + 1);
+}
+
+inline void put_i32(HeaderWriter *writer, i32 value) {
+	put_bytes(writer, &value, sizeof(value));
+}
+
+inline void put_f32(HeaderWriter *writer, f32 value) {
+	put_bytes(writer, &value, sizeof(value));
+}
+
+inline void put_exr_attribute(HeaderWriter *writer, const char *name, const char *type, i32 size) {
+	put_string(writer, name);
+	put_string(writer, type);
+	put_i32(writer, size);
+}
+
+inline u64 exr_chunk_size(u32 cols) {
+	// y, byte count, then B, G and R for the whole line
+	return 8 + 3 * sizeof(f32) * (u64) cols;
+}
+
+inline b8 write_exr_header(FloatImage *image) {
+	HeaderWriter writer = {};
+	u8 magic[8] = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0}; // version 2, single part scanline
+	put_bytes(&writer, magic, sizeof(magic));
+	// channels go in alphabetical order, each is name, pixel type (2 is
+	// float), pLinear and 3 reserved bytes, x and y sampling
+	put_exr_attribute(&writer, "channels", "chlist", 3 * (2 + 16) + 1);
+	const char *channels[3] = {"B", "G", "R"};
+	for (u32 c = 0; c < 3; c++) {
+		u8 linear_reserved[4] = {};
+		put_string(&writer, channels[c]);
+		put_i32(&writer, 2);
+		put_bytes(&writer, linear_reserved, sizeof(linear_reserved));
+		put_i32(&writer, 1);
+		put_i32(&writer, 1);
+	}
+	u8 zero = 0;
+	put_bytes(&writer, &zero, 1);
+	put_exr_attribute(&writer, "compression", "compression", 1);
+	put_bytes(&writer, &zero, 1);
+	const char *windows[2] = {"dataWindow", "displayWindow"};
+	for (u32 w = 0; w < 2; w++) {
+		put_exr_attribute(&writer, windows[w], "box2i", 16);
+		put_i32(&writer, 0);
+		put_i32(&writer, 0);
+		put_i32(&writer, (i32) image->cols - 1);
+		put_i32(&writer, (i32) image->rows - 1);
+	}
+	put_exr_attribute(&writer, "lineOrder", "lineOrder", 1);
+	put_bytes(&writer, &zero, 1); // increasing y
+	put_exr_attribute(&writer, "pixelAspectRatio", "float", 4);
+	put_f32(&writer, 1.0);
+	put_exr_attribute(&writer, "screenWindowCenter", "v2f", 8);
+	put_f32(&writer, 0.0);
+	put_f32(&writer, 0.0);
+	put_exr_attribute(&writer, "screenWindowWidth", "float", 4);
+	put_f32(&writer, 1.0);
+	put_bytes(&writer, &zero, 1); // end of header
+	if (!write_at(image->file, 0, writer.bytes, writer.size)) {
+		return false;
+	}
+	// one scanline per chunk, so the offset table and the y and size in
+	// front of every line are known before any pixel is
+	u64 table_size = sizeof(u64) * image->rows;
+	image->data_offset = writer.size + table_size;
+	u64 chunk_size = exr_chunk_size(image->cols);
+	u64 *offsets = (u64 *) malloc(table_size);
+	for (u32 i = 0; i < image->rows; i++) {
+		offsets[i] = image->data_offset + i * chunk_size;
+	}
+	b8 ok = write_at(image->file, writer.size, offsets, table_size);
+	free(offsets);
+	for (u32 i = 0; ok && (i < image->rows); i++) {
+		i32 line[2] = {(i32) i, (i32) (chunk_size - 8)};
+		ok = write_at(image->file, image->data_offset + i * chunk_size, line, sizeof(line));
+	}
+	return ok;
+}
+
+inline b8 write_pfm_header(FloatImage *image) {
+	HeaderWriter writer = {};
+	// a negative scale means little endian
+	writer.size = (u32) snprintf((char *) writer.bytes, sizeof(writer.bytes), "PF\n%u %u\n-1.0\n", image->cols, image->rows);
+	image->data_offset = writer.size;
+	return write_at(image->file, 0, writer.bytes, writer.size);
+}
+
+// Create the file at its full size with the header in place, false if that
+// didn't work out
+inline b8 open_float_image(FloatImage *image, const char *path, FloatFormat format, u32 rows, u32 cols) {
+	*image = {};
+	image->format = format;
+	image->rows = rows;
+	image->cols = cols;
+	image->file = create_file(path);
+	if (image->file == INVALID_FILE) {
+		return false;
+	}
+	b8 ok = false;
+	u64 file_size = 0;
+	if (format == FLOAT_FORMAT_PFM) {
+		ok = write_pfm_header(image);
+		file_size = image->data_offset + 3 * sizeof(f32) * (u64) rows * cols;
+	} else if (format == FLOAT_FORMAT_EXR) {
+		ok = write_exr_header(image);
+		file_size = image->data_offset + rows * exr_chunk_size(cols);
+	}
+	ok = ok && resize_file(image->file, file_size);
+	if (!ok) {
+		close_file(image->file);
+		image->file = INVALID_FILE;
+	}
+	return ok;
+}
+
+inline void close_float_image(FloatImage *image) {
+	if (image->file != INVALID_FILE) {
+		close_file(image->file);
+		image->file = INVALID_FILE;
+	}
+}
+
+// Resolve the film over a tile and write it into place, one positional
+// write per row (per channel and row for EXR). Safe to call from several
+// workers at once as long as their tiles don't overlap.
+inline b8 write_float_tile(FloatImage *image, Film *film, u32 row_min, u32 row_max, u32 col_min, u32 col_max) {
+	u32 tile_cols = col_max - col_min;
+	f32 *line = (f32 *) malloc(3 * sizeof(f32) * tile_cols);
+	b8 ok = true;
+	for (u32 i = row_min; ok && (i < row_max); i++) {
+		if (image->format == FLOAT_FORMAT_PFM) {
+			for (u32 j = col_min; j < col_max; j++) {
+				RGBA color = resolve_pixel(film, film_index(film, i, j));
+				f32 *pixel = line + 3 * (j - col_min);
+				pixel[0] = color.r;
+				pixel[1] = color.g;
+				pixel[2] = color.b;
+			}
+			u64 offset = image->data_offset + 3 * sizeof(f32) * ((u64) (image->rows - 1 - i) * image->cols + col_min);
+			ok = write_at(image->file, offset, line, 3 * sizeof(f32) * tile_cols);
+		} else {
+			f32 *blue = line;
+			f32 *green = line + tile_cols;
+			f32 *red = line + 2 * tile_cols;
+			for (u32 j = col_min; j < col_max; j++) {
+				RGBA color = resolve_pixel(film, film_index(film, i, j));
+				blue[j - col_min] = color.b;
+				green[j - col_min] = color.g;
+				red[j - col_min] = color.r;
+			}
+			u64 line_offset = image->data_offset + i * exr_chunk_size(image->cols) + 8;
+			for (u32 c = 0; ok && (c < 3); c++) {
+				u64 offset = line_offset + sizeof(f32) * ((u64) c * image->cols + col_min);
+				ok = write_at(image->file, offset, line + c * tile_cols, sizeof(f32) * tile_cols);
+			}
+		}
+	}
+	free(line);
+	return ok;
+}
+#endif //YELLOW_HDR
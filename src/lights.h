@@ -0,0 +1,107 @@
+#ifndef YELLOW_LIGHTS
+#define YELLOW_LIGHTS
+#include <cmath>
+#include <cstdlib>
+#include "types.h"
+#include "linalg.h"
+#include "colors.h"
+#include "materials.h"
+#include "cameras.h"
+
+// Direction toward a spherical light, sampled uniformly over the cone of
+// directions it subtends, see PBRT 6.2.4
+struct LightSample {
+	Vec3D direction; // unit length
+	f32 pdf; // solid angle density
+};
+
+inline b8 is_emissive(Material *material) {
+	return (material->emit.r > 0.0) || (material->emit.g > 0.0) || (material->emit.b > 0.0);
+}
+
+// Copy every sphere with an emissive material into the world's light list
+inline void build_light_list(World *world) {
+	u32 num_lights = 0;
+	for (u32 i = 0; i < world->num_spheres; i++) {
+		if (is_emissive(&world->materials[world->spheres[i].material_index])) {
+			num_lights++;
+		}
+	}
+	world->num_lights = num_lights;
+	world->lights = NULL;
+	if (num_lights == 0) {
+		return;
+	}
+	world->lights = (Sphere *) malloc(sizeof(Sphere) * num_lights);
+	u32 l = 0;
+	for (u32 i = 0; i < world->num_spheres; i++) {
+		if (is_emissive(&world->materials[world->spheres[i].material_index])) {
+			world->lights[l++] = world->spheres[i];
+		}
+	}
+}
+
+// Find the cone of directions from point that hit the light. Returns false
+// when the point is on or inside the light and there's no cone to sample.
+// one_minus_cos_max is 1 - cos(half angle), computed as sin^2 / (1 + cos)
+// so small far away lights don't round to an empty cone.
+inline b8 light_cone(
+	Point3D *point,
+	Sphere *light,
+	Vec3D *to_center,
+	f32 *distance_squared,
+	f32 *one_minus_cos_max
+) {
+	*to_center = light->origin - *point;
+	*distance_squared = l2_norm_squared(to_center);
+	f32 radius_squared = light->radius * light->radius;
+	if (*distance_squared <= radius_squared * 1.0001) {
+		return false;
+	}
+	f32 sin_squared = radius_squared / *distance_squared;
+	f32 cos_max = sqrt(fmax(0.0, 1.0 - sin_squared));
+	*one_minus_cos_max = sin_squared / (1.0 + cos_max);
+	return true;
+}
+
+inline f32 light_cone_pdf(Point3D *point, Sphere *light) {
+	Vec3D to_center;
+	f32 distance_squared;
+	f32 one_minus_cos_max;
+	if (!light_cone(point, light, &to_center, &distance_squared, &one_minus_cos_max)) {
+		return 0.0;
+	}
+	return 1.0 / (2.0 * M_PI * one_minus_cos_max);
+}
+
+inline b8 sample_light_cone(PRNGState *prng_state, Point3D *point, Sphere *light, LightSample *sample) {
+	Vec3D to_center;
+	f32 distance_squared;
+	f32 one_minus_cos_max;
+	if (!light_cone(point, light, &to_center, &distance_squared, &one_minus_cos_max)) {
+		return false;
+	}
+	Vec3D w = to_center / sqrt(distance_squared);
+	// any vector not parallel to w works for building the frame
+	Vec3D helper = (fabs(w.x) > 0.9) ? (Vec3D) {0.0, 1.0, 0.0} : (Vec3D) {1.0, 0.0, 0.0};
+	Vec3D u = cross(&helper, &w);
+	u = normalize(&u);
+	Vec3D v = cross(&w, &u);
+	f32 cos_theta = 1.0 - unit_uniform(prng_state) * one_minus_cos_max;
+	f32 sin_theta = sqrt(fmax(0.0, 1.0 - cos_theta * cos_theta));
+	f32 phi = 2.0 * M_PI * unit_uniform(prng_state);
+	sample->direction = (u * (cosf(phi) * sin_theta)) + (v * (sinf(phi) * sin_theta)) + (w * cos_theta);
+	sample->pdf = 1.0 / (2.0 * M_PI * one_minus_cos_max);
+	return true;
+}
+
+// Power heuristic with beta = 2, written as a ratio so a zero pdf gives a
+// zero weight rather than 0 / 0, and large cone pdfs don't square to inf
+inline f32 mis_weight(f32 pdf, f32 other_pdf) {
+	if (pdf <= 0.0) {
+		return 0.0;
+	}
+	f32 ratio = other_pdf / pdf;
+	return 1.0 / (1.0 + ratio * ratio);
+}
+#endif //YELLOW_LIGHTS
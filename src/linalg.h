@@ -113,22 +113,38 @@ inline Vec3D random_bilateral(PRNGState *prng_state) {
 	return direction;
 }
 
-inline Vec3D random_unit_vector(PRNGState *prng_state) {
-	Vec3D direction = random_bilateral(prng_state);
-	direction = normalize(&direction);
-	return direction;
-}
-
-inline Vec3D random_unit_sphere_vector(PRNGState *prng_state) {
+// Adds the number of candidates the rejection loop drew to *num_draws, 6/pi
+// on average
+inline Vec3D random_unit_sphere_vector(PRNGState *prng_state, u32 *num_draws) {
 	f32 l2_squared = 2.0;
 	Vec3D direction;
 	while (l2_squared > 1.0) {
 		direction = random_bilateral(prng_state);
 		l2_squared = l2_norm_squared(&direction);
+		*num_draws += 1;
 	}
 	return direction;
 }
 
+inline Vec3D random_unit_sphere_vector(PRNGState *prng_state) {
+	u32 num_draws = 0;
+	return random_unit_sphere_vector(prng_state, &num_draws);
+}
+
+// Uniform on the surface of the unit sphere. Normalizing a point of the cube
+// would crowd directions towards its corners, and diffuse_bounce relies on
+// normal + this being cosine distributed.
+inline Vec3D random_unit_vector(PRNGState *prng_state, u32 *num_draws) {
+	Vec3D direction = random_unit_sphere_vector(prng_state, num_draws);
+	direction = normalize(&direction);
+	return direction;
+}
+
+inline Vec3D random_unit_vector(PRNGState *prng_state) {
+	u32 num_draws = 0;
+	return random_unit_vector(prng_state, &num_draws);
+}
+
 inline Vec3D random_unit_disk_vector(PRNGState *prng_state) {
 	f32 l2_squared = 2.0;
 	Vec3D direction;
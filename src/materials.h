@@ -1,9 +1,12 @@
 #ifndef YELLOW_MATERIALS
 #define YELLOW_MATERIALS
+#include <cstdlib>
 #include "types.h"
 #include "linalg.h"
 #include "colors.h"
-//TODO(dd): rearrange these structs for SIMD
+
+// spheres are mirrored into padded arrays so we can test this many at once
+#define SPHERE_SOA_WIDTH 8
 
 struct Material {
 	RGBA color;
@@ -18,12 +21,25 @@ struct Sphere {
 	u32 material_index;
 };
 
+struct SphereSoA {
+	u32 count;
+	u32 padded_count; // multiple of SPHERE_SOA_WIDTH
+	f32 *x;
+	f32 *y;
+	f32 *z;
+	f32 *radius;
+	u32 *material_index;
+};
+
 struct Plane {
 	Vec3D normal;
 	f32 distance;
 	u32 material_index;
 };
 
+struct BVH;
+struct WideBVH;
+
 struct World {
 	u32 num_materials;
 	u32 num_spheres;
@@ -31,5 +47,41 @@ struct World {
 	Material *materials;
 	Sphere *spheres;
 	Plane *planes;
+	u32 num_lights;
+	Sphere *lights; // emissive spheres, for light sampling
+	SphereSoA *sphere_soa;
+	BVH *bvh;
+	WideBVH *wide_bvh;
 };
+
+inline SphereSoA *build_sphere_soa(Sphere *spheres, u32 num_spheres) {
+	SphereSoA *soa = (SphereSoA *) malloc(sizeof(SphereSoA));
+	u32 padded_count = ((num_spheres + SPHERE_SOA_WIDTH - 1) / SPHERE_SOA_WIDTH) * SPHERE_SOA_WIDTH;
+	soa->count = num_spheres;
+	soa->padded_count = padded_count;
+	soa->x = (f32 *) malloc(sizeof(f32) * padded_count);
+	soa->y = (f32 *) malloc(sizeof(f32) * padded_count);
+	soa->z = (f32 *) malloc(sizeof(f32) * padded_count);
+	soa->radius = (f32 *) malloc(sizeof(f32) * padded_count);
+	soa->material_index = (u32 *) malloc(sizeof(u32) * padded_count);
+	for (u32 i = 0; i < padded_count; i++) {
+		// padding lanes are masked out by index, the values just need to be finite
+		Sphere sphere = (i < num_spheres) ? spheres[i] : (Sphere) {};
+		soa->x[i] = sphere.origin.x;
+		soa->y[i] = sphere.origin.y;
+		soa->z[i] = sphere.origin.z;
+		soa->radius[i] = sphere.radius;
+		soa->material_index[i] = sphere.material_index;
+	}
+	return soa;
+}
+
+inline void free_sphere_soa(SphereSoA *soa) {
+	free(soa->x);
+	free(soa->y);
+	free(soa->z);
+	free(soa->radius);
+	free(soa->material_index);
+	free(soa);
+}
 #endif //YELLOW_MATERIALS
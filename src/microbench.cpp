@@ -0,0 +1,390 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "types.h"
+#include "rand.h"
+#include "linalg.h"
+#include "colors.h"
+#include "materials.h"
+#include "cameras.h"
+#include "threads.h"
+#include "ray.h"
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define MICROBENCH_HAS_TSC
+#endif
+
+// Times the hot kernels on fixed inputs, away from a full render. Every
+// input set comes from a fixed seed, so numbers from two builds are for the
+// same rays and spheres. Each kernel runs MICROBENCH_REPEATS times and the
+// fastest run is reported, in ns and in time stamp counter ticks per op.
+// NOTE(dd): the TSC ticks at a fixed reference rate, so cycles/op only
+// matches core cycles with turbo and frequency scaling off.
+#define MICROBENCH_SEED 1234567
+#define MICROBENCH_REPEATS 3
+#define MICROBENCH_NUM_RAYS (1 << 16)
+#define MICROBENCH_NUM_OPS (1 << 20)
+// sphere tests per run for the flat (linear, SoA) paths, so big sets don't
+// take forever
+#define MICROBENCH_FLAT_BUDGET (1 << 24)
+#define MICROBENCH_MAX_FLAT_SPHERES 4096
+#define MICROBENCH_CLOUD_EXTENT 10.0
+
+struct BenchInput {
+	u32 num_ops;
+	Ray *rays;
+	f32 *t_max;
+	World *world;
+	Sphere *sphere;
+	Plane *plane;
+	PreparedCamera *camera;
+	RGBA *colors;
+	PRNGState prng_state;
+	f32 sink; // everything computed lands here so it can't be optimized out
+};
+
+// Runs the kernel once over the whole input and returns how many ops hit
+typedef u32 (*BenchKernel)(BenchInput *input);
+
+inline u64 read_cycles() {
+#ifdef MICROBENCH_HAS_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+inline void run_bench(const char *name, BenchKernel kernel, BenchInput *input, b8 show_hits) {
+	f64 best_seconds = 1e30;
+	u64 best_cycles = 0;
+	u32 hits = 0;
+	for (u32 r = 0; r < MICROBENCH_REPEATS; r++) {
+		input->prng_state = (PRNGState) {MICROBENCH_SEED};
+		warm_up_xor_shift(&input->prng_state);
+		f64 start = tick();
+		u64 start_cycles = read_cycles();
+		hits = kernel(input);
+		u64 cycles = read_cycles() - start_cycles;
+		f64 seconds = tick() - start;
+		if (seconds < best_seconds) {
+			best_seconds = seconds;
+			best_cycles = cycles;
+		}
+	}
+	f64 ns_per_op = (best_seconds * 1e9) / (f64) input->num_ops;
+	f64 cycles_per_op = (f64) best_cycles / (f64) input->num_ops;
+	if (show_hits) {
+		printf(
+			"[bench] %-36s %10.2f ns/op %10.1f cycles/op %6.1f%% hit\n",
+			name,
+			ns_per_op,
+			cycles_per_op,
+			100.0 * hits / input->num_ops
+		);
+	} else {
+		printf("[bench] %-36s %10.2f ns/op %10.1f cycles/op\n", name, ns_per_op, cycles_per_op);
+	}
+}
+
+inline u32 bench_intersect_sphere(BenchInput *input) {
+	u32 hits = 0;
+	for (u32 i = 0; i < input->num_ops; i++) {
+		IntersectionResult result = intersect_sphere(input->rays + i, input->sphere);
+		hits += result.intersected;
+		input->sink += result.normal.x;
+	}
+	return hits;
+}
+
+inline u32 bench_intersect_plane(BenchInput *input) {
+	u32 hits = 0;
+	for (u32 i = 0; i < input->num_ops; i++) {
+		IntersectionResult result = intersect_plane(input->rays + i, input->plane);
+		hits += result.intersected;
+		input->sink += result.distance;
+	}
+	return hits;
+}
+
+inline u32 bench_find_intersection(BenchInput *input) {
+	u32 hits = 0;
+	for (u32 i = 0; i < input->num_ops; i++) {
+		Intersection intersection = find_intersection(input->rays + i, input->world);
+		hits += intersection.intersected;
+		input->sink += intersection.normal.x;
+	}
+	return hits;
+}
+
+inline u32 bench_occluded(BenchInput *input) {
+	u32 hits = 0;
+	for (u32 i = 0; i < input->num_ops; i++) {
+		hits += occluded(input->rays + i, input->world, input->t_max[i]);
+	}
+	return hits;
+}
+
+inline u32 bench_prime_ray(BenchInput *input) {
+	u32 cols = 1024;
+	for (u32 i = 0; i < input->num_ops; i++) {
+		f32 row = (f32) (i / cols) + unit_uniform(&input->prng_state);
+		f32 col = (f32) (i % cols) + unit_uniform(&input->prng_state);
+		Ray ray = prime_ray(&input->prng_state, input->camera, row, col, NULL);
+		input->sink += ray.direction.x;
+	}
+	return 0;
+}
+
+inline u32 bench_prime_ray_row(BenchInput *input) {
+	u32 cols = 1024;
+	Ray rays[1024];
+	for (u32 i = 0; i < input->num_ops; i += cols) {
+		prime_ray_row(&input->prng_state, input->camera, i / cols, 0, cols, rays, NULL);
+		// sink every ray, like bench_prime_ray, so no part of the row can be optimized away
+		for (u32 k = 0; k < cols; k++) {
+			input->sink += rays[k].direction.x;
+		}
+	}
+	return 0;
+}
+
+inline u32 bench_unit_uniform(BenchInput *input) {
+	for (u32 i = 0; i < input->num_ops; i++) {
+		input->sink += unit_uniform(&input->prng_state);
+	}
+	return 0;
+}
+
+inline u32 bench_random_unit_vector(BenchInput *input) {
+	for (u32 i = 0; i < input->num_ops; i++) {
+		input->sink += random_unit_vector(&input->prng_state).x;
+	}
+	return 0;
+}
+
+inline u32 bench_random_unit_sphere_vector(BenchInput *input) {
+	for (u32 i = 0; i < input->num_ops; i++) {
+		input->sink += random_unit_sphere_vector(&input->prng_state).x;
+	}
+	return 0;
+}
+
+inline u32 bench_random_unit_disk_vector(BenchInput *input) {
+	for (u32 i = 0; i < input->num_ops; i++) {
+		input->sink += random_unit_disk_vector(&input->prng_state).x;
+	}
+	return 0;
+}
+
+inline u32 bench_rgba_to_u32(BenchInput *input) {
+	u32 mask = MICROBENCH_NUM_RAYS - 1;
+	u32 bits = 0;
+	for (u32 i = 0; i < input->num_ops; i++) {
+		bits ^= rgba_to_u32(input->colors + (i & mask));
+	}
+	input->sink += (f32) (bits & 0xff);
+	return 0;
+}
+
+// A direction perpendicular to direction, of unit length
+inline Vec3D random_perpendicular(PRNGState *prng_state, Vec3D *direction) {
+	Vec3D r = random_unit_vector(prng_state);
+	Vec3D p = cross(direction, &r);
+	return normalize(&p);
+}
+
+// Rays from a shell around a unit sphere at the origin. A hit_rate fraction
+// aim inside it, the rest pass beside it.
+inline void make_sphere_rays(PRNGState *prng_state, Ray *rays, u32 count, f32 hit_rate) {
+	for (u32 i = 0; i < count; i++) {
+		Point3D origin = 5.0 * random_unit_vector(prng_state);
+		Point3D target;
+		if (unit_uniform(prng_state) < hit_rate) {
+			target = 0.9 * random_unit_sphere_vector(prng_state);
+		} else {
+			Vec3D towards = -origin;
+			target = random_perpendicular(prng_state, &towards) * uniform(prng_state, 1.5, 3.0);
+		}
+		rays[i] = (Ray) {origin, target - origin};
+	}
+}
+
+// Rays at the plane y = 0 from below. intersect_plane only takes hits on
+// rays travelling along the normal, so a hit_rate fraction go up through it
+// and the rest head down and away.
+inline void make_plane_rays(PRNGState *prng_state, Ray *rays, u32 count, f32 hit_rate) {
+	for (u32 i = 0; i < count; i++) {
+		Point3D origin = {uniform(prng_state, -10, 10), uniform(prng_state, -5, -0.5), uniform(prng_state, -10, 10)};
+		Vec3D direction = random_unit_vector(prng_state);
+		if (unit_uniform(prng_state) < hit_rate) {
+			direction.y = fabs(direction.y) + 0.1;
+		} else {
+			direction.y = -fabs(direction.y) - 0.1;
+		}
+		rays[i] = (Ray) {origin, direction};
+	}
+}
+
+inline World make_cloud(PRNGState *prng_state, u32 num_spheres, Material *material) {
+	World world = {};
+	world.num_materials = 1;
+	world.materials = material;
+	world.num_spheres = num_spheres;
+	world.spheres = (Sphere *) malloc(sizeof(Sphere) * num_spheres);
+	// keeps the fraction of the volume that's filled about the same across sizes
+	f32 radius = 2.0 / cbrtf((f32) num_spheres);
+	f32 e = MICROBENCH_CLOUD_EXTENT;
+	for (u32 i = 0; i < num_spheres; i++) {
+		Sphere *sphere = world.spheres + i;
+		sphere->origin = (Point3D) {uniform(prng_state, -e, e), uniform(prng_state, -e, e), uniform(prng_state, -e, e)};
+		sphere->radius = radius;
+		sphere->material_index = 0;
+	}
+	return world;
+}
+
+// Rays from outside the cloud. A hit_rate fraction aim into a random sphere,
+// so they're sure to hit something, the rest pass outside the cloud's
+// bounding sphere. t_max is the distance to the aimed at point, so
+// occlusion queries on hitting rays are sure to be blocked.
+inline void make_cloud_rays(PRNGState *prng_state, World *world, Ray *rays, f32 *t_max, u32 count, f32 hit_rate) {
+	f32 bounding_radius = MICROBENCH_CLOUD_EXTENT * sqrt(3.0) + 1.0;
+	for (u32 i = 0; i < count; i++) {
+		Point3D origin = (2.0 * bounding_radius) * random_unit_vector(prng_state);
+		Point3D target;
+		if (unit_uniform(prng_state) < hit_rate) {
+			u32 s = (u32) (unit_uniform(prng_state) * world->num_spheres);
+			if (s >= world->num_spheres) {
+				s = world->num_spheres - 1;
+			}
+			Sphere *sphere = world->spheres + s;
+			target = sphere->origin + (0.5 * sphere->radius) * random_unit_sphere_vector(prng_state);
+		} else {
+			Vec3D towards = -origin;
+			target = random_perpendicular(prng_state, &towards) * uniform(prng_state, 1.1 * bounding_radius, 2.0 * bounding_radius);
+		}
+		Vec3D direction = target - origin;
+		f32 length = l2_norm(&direction);
+		rays[i] = (Ray) {origin, direction / length};
+		t_max[i] = length;
+	}
+}
+
+inline void bench_cloud(const char *accel, World *world, f32 hit_rate, Ray *rays, f32 *t_max, PRNGState *prng_state) {
+	u32 num_rays = MICROBENCH_NUM_RAYS;
+	if (!world->wide_bvh && !world->bvh) {
+		num_rays = MICROBENCH_FLAT_BUDGET / world->num_spheres;
+		if (num_rays > MICROBENCH_NUM_RAYS) {
+			num_rays = MICROBENCH_NUM_RAYS;
+		}
+	}
+	make_cloud_rays(prng_state, world, rays, t_max, num_rays, hit_rate);
+	BenchInput input = {};
+	input.num_ops = num_rays;
+	input.rays = rays;
+	input.t_max = t_max;
+	input.world = world;
+	char name[64];
+	snprintf(name, sizeof(name), "find_intersection/%s/%u/%.0f%%", accel, world->num_spheres, hit_rate * 100.0);
+	run_bench(name, bench_find_intersection, &input, true);
+	snprintf(name, sizeof(name), "occluded/%s/%u/%.0f%%", accel, world->num_spheres, hit_rate * 100.0);
+	run_bench(name, bench_occluded, &input, true);
+}
+
+int main() {
+	PRNGState prng_state = {MICROBENCH_SEED};
+	warm_up_xor_shift(&prng_state);
+	Ray *rays = (Ray *) malloc(sizeof(Ray) * MICROBENCH_NUM_RAYS);
+	f32 *t_max = (f32 *) malloc(sizeof(f32) * MICROBENCH_NUM_RAYS);
+	f32 hit_rates[] = {0.1, 0.5, 0.9};
+	u32 num_hit_rates = sizeof(hit_rates) / sizeof(hit_rates[0]);
+	char name[64];
+
+	// single primitive kernels
+	Sphere sphere = {(Point3D) {0.0, 0.0, 0.0}, 1.0, 0};
+	Plane plane = {};
+	plane.normal = (Vec3D) {0.0, 1.0, 0.0};
+	plane.distance = 0.0;
+	for (u32 h = 0; h < num_hit_rates; h++) {
+		BenchInput input = {};
+		input.num_ops = MICROBENCH_NUM_RAYS;
+		input.rays = rays;
+		input.sphere = &sphere;
+		input.plane = &plane;
+		make_sphere_rays(&prng_state, rays, MICROBENCH_NUM_RAYS, hit_rates[h]);
+		snprintf(name, sizeof(name), "intersect_sphere/%.0f%%", hit_rates[h] * 100.0);
+		run_bench(name, bench_intersect_sphere, &input, true);
+		make_plane_rays(&prng_state, rays, MICROBENCH_NUM_RAYS, hit_rates[h]);
+		snprintf(name, sizeof(name), "intersect_plane/%.0f%%", hit_rates[h] * 100.0);
+		run_bench(name, bench_intersect_plane, &input, true);
+	}
+
+	// whole scene queries, on every acceleration path that makes sense at
+	// each size, linear first as the baseline
+	Material material = {};
+	u32 sizes[] = {16, 256, 4096, 65536};
+	for (u32 s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		World world = make_cloud(&prng_state, sizes[s], &material);
+		for (u32 h = 0; h < num_hit_rates; h++) {
+			if (world.num_spheres <= MICROBENCH_MAX_FLAT_SPHERES) {
+				bench_cloud("linear", &world, hit_rates[h], rays, t_max, &prng_state);
+				world.sphere_soa = build_sphere_soa(world.spheres, world.num_spheres);
+				bench_cloud("soa", &world, hit_rates[h], rays, t_max, &prng_state);
+				free_sphere_soa(world.sphere_soa);
+				world.sphere_soa = NULL;
+			}
+			world.bvh = build_bvh(world.spheres, world.num_spheres);
+			bench_cloud("bvh", &world, hit_rates[h], rays, t_max, &prng_state);
+			world.wide_bvh = build_wide_bvh(world.bvh);
+			bench_cloud("wide_bvh", &world, hit_rates[h], rays, t_max, &prng_state);
+			release_world(&world);
+		}
+		free(world.spheres);
+	}
+
+	// camera rays, with and without a lens to sample
+	Camera camera = {};
+	camera.origin = (Point3D) {0.0, 0.0, 0.0};
+	camera.normal = (Vec3D) {0.0, 0.0, 1.0};
+	camera.up = (Vec3D) {0.0, 1.0, 0.0};
+	camera.image_plane = create_image_plane(60.0, 1.0, 1024);
+	camera.focal_distance = 1.0;
+	f32 apertures[] = {0.0, 0.1};
+	for (u32 a = 0; a < 2; a++) {
+		camera.aperture = apertures[a];
+		PreparedCamera prepared = prepare_camera(&camera);
+		BenchInput input = {};
+		input.num_ops = MICROBENCH_NUM_OPS;
+		input.camera = &prepared;
+		snprintf(name, sizeof(name), "prime_ray/aperture %.1f", apertures[a]);
+		run_bench(name, bench_prime_ray, &input, false);
+		snprintf(name, sizeof(name), "prime_ray_row/aperture %.1f", apertures[a]);
+		run_bench(name, bench_prime_ray_row, &input, false);
+	}
+
+	// samplers built on xor_shift32
+	BenchInput input = {};
+	input.num_ops = MICROBENCH_NUM_OPS;
+	run_bench("unit_uniform", bench_unit_uniform, &input, false);
+	run_bench("random_unit_vector", bench_random_unit_vector, &input, false);
+	run_bench("random_unit_sphere_vector", bench_random_unit_sphere_vector, &input, false);
+	run_bench("random_unit_disk_vector", bench_random_unit_disk_vector, &input, false);
+
+	// output conversion, over colors that go past 1 like real pixels do
+	RGBA *colors = (RGBA *) malloc(sizeof(RGBA) * MICROBENCH_NUM_RAYS);
+	for (u32 i = 0; i < MICROBENCH_NUM_RAYS; i++) {
+		colors[i] = (RGBA) {uniform(&prng_state, 0, 1.2), uniform(&prng_state, 0, 1.2), uniform(&prng_state, 0, 1.2), 1.0};
+	}
+	input.colors = colors;
+	run_bench("rgba_to_u32", bench_rgba_to_u32, &input, false);
+
+	printf("[info] sink %f\n", input.sink);
+	free(colors);
+	free(t_max);
+	free(rays);
+	return 0;
+}
@@ -0,0 +1,106 @@
+#ifndef YELLOW_PROFILE
+#define YELLOW_PROFILE
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "types.h"
+#include "colors.h"
+#include "threads.h"
+// NOTE(dd): stb_image_write comes in through render.h, which defines the
+// implementation and includes this file after it
+
+// Tile records as Chrome trace events, one complete ("X") event per tile on
+// the track of the worker that rendered it. Load in chrome://tracing or
+// https://ui.perfetto.dev. Times are microseconds from render_start.
+inline b8 write_tile_trace(const char *path, TileRecord *records, u64 num_records, f64 render_start) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		return false;
+	}
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	for (u64 r = 0; r < num_records; r++) {
+		TileRecord *record = records + r;
+		fprintf(
+			file,
+			"{\"name\": \"tile %u,%u\", \"cat\": \"pass %u\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, "
+			"\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"rows\": [%u, %u], \"cols\": [%u, %u], "
+			"\"rays\": %llu, \"samples\": %llu}}%s\n",
+			record->row_min,
+			record->col_min,
+			record->pass,
+			record->worker,
+			(record->start - render_start) * 1e6,
+			(record->end - record->start) * 1e6,
+			record->row_min,
+			record->row_max,
+			record->col_min,
+			record->col_max,
+			(unsigned long long) record->ray_count,
+			(unsigned long long) record->sample_count,
+			(r + 1 < num_records) ? "," : ""
+		);
+	}
+	fprintf(file, "]}\n");
+	fclose(file);
+	return true;
+}
+
+// Black through red and yellow to white as cost goes from 0 to 1
+inline RGBA heat_color(f32 cost) {
+	f32 r = fmin(fmax(3.0 * cost, 0.0), 1.0);
+	f32 g = fmin(fmax(3.0 * cost - 1.0, 0.0), 1.0);
+	f32 b = fmin(fmax(3.0 * cost - 2.0, 0.0), 1.0);
+	return (RGBA) {r, g, b, 1.0};
+}
+
+// Seconds spent per pixel, summed over passes and scaled to the most
+// expensive pixel, so glass and lights stand out from the sky
+inline b8 write_tile_heatmap(const char *path, TileRecord *records, u64 num_records, u32 rows, u32 cols) {
+	u64 num_pixels = (u64) rows * cols;
+	f32 *cost = (f32 *) calloc(num_pixels, sizeof(f32));
+	for (u64 r = 0; r < num_records; r++) {
+		TileRecord *record = records + r;
+		u32 tile_pixels = (record->row_max - record->row_min) * (record->col_max - record->col_min);
+		f32 per_pixel = (f32) ((record->end - record->start) / (f64) tile_pixels);
+		for (u32 i = record->row_min; i < record->row_max; i++) {
+			for (u32 j = record->col_min; j < record->col_max; j++) {
+				cost[(u64) i * cols + j] += per_pixel;
+			}
+		}
+	}
+	f32 max_cost = 0.0;
+	for (u64 p = 0; p < num_pixels; p++) {
+		max_cost = fmax(max_cost, cost[p]);
+	}
+	u32 *image = (u32 *) malloc(sizeof(u32) * num_pixels);
+	for (u64 p = 0; p < num_pixels; p++) {
+		RGBA color = heat_color((max_cost > 0.0) ? cost[p] / max_cost : 0.0);
+		// NOTE(dd): rgba_to_u32 gamma encodes, which is fine for a color ramp
+		image[p] = rgba_to_u32(&color);
+	}
+	b8 ok = stbi_write_bmp(path, cols, rows, 4, image) != 0;
+	free(image);
+	free(cost);
+	return ok;
+}
+
+// How busy the workers were between render_start and render_end, and the
+// slowest single tile, to spot scheduling gaps and stragglers without
+// opening the trace
+inline void print_tile_summary(TileRecord *records, u64 num_records, u32 num_workers, f64 render_start, f64 render_end) {
+	f64 busy = 0.0;
+	f64 slowest = 0.0;
+	for (u64 r = 0; r < num_records; r++) {
+		f64 duration = records[r].end - records[r].start;
+		busy += duration;
+		slowest = fmax(slowest, duration);
+	}
+	f64 wall = render_end - render_start;
+	printf(
+		"[info] %llu tiles, workers busy %.1f%% of the time, slowest tile %.3f ms\n",
+		(unsigned long long) num_records,
+		100.0 * busy / (wall * num_workers),
+		slowest * 1e3
+	);
+}
+#endif //YELLOW_PROFILE
@@ -48,6 +48,27 @@ inline void warm_up_xor_shift(PRNGState *prng_state) {
 	}
 }
 
+// Murmur3's finalizer, every input bit affects every output bit
+inline u32 hash_u32(u32 x) {
+	x ^= x >> 16;
+	x *= 0x85ebca6b;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35;
+	x ^= x >> 16;
+	return x;
+}
+
+// A generator that depends only on (seed, stream, pass), for renders that
+// have to come out the same every time. Streams are tile indices.
+inline PRNGState seeded_prng_state(u32 seed, u32 stream, u32 pass) {
+	PRNGState prng_state = {hash_u32(seed ^ hash_u32(stream ^ hash_u32(pass + 0x9e3779b9)))};
+	if (prng_state.entropy < 1) {
+		prng_state.entropy += 2;
+	}
+	warm_up_xor_shift(&prng_state);
+	return prng_state;
+}
+
 inline f32 unit_uniform(PRNGState *prng_state) {
 	return xor_shift32(prng_state) / (f32) UINT32_MAX;
 }
@@ -2,13 +2,17 @@
 #define YELLOW_RAY
 #include <cmath>
 #include <cstdio>
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
 #include "linalg.h"
 #include "colors.h"
 #include "materials.h"
+#include "bvh.h"
+#include "lights.h"
 #include "cameras.h"
 #include "threads.h"
+#include "stats.h"
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 struct Ray {
 	Point3D origin;
@@ -19,10 +23,18 @@ inline Point3D ray_at(Ray *ray, f32 t) {
 	return ray->origin + (t * ray->direction);
 }
 
-inline Ray diffuse_bounce(PRNGState *prng_state, Ray *ray, Vec3D *normal_pointer, Point3D *off_pointer) {
+inline Ray diffuse_bounce(
+	PRNGState *prng_state,
+	Ray *ray,
+	Vec3D *normal_pointer,
+	Point3D *off_pointer,
+	PathStats *path_stats
+) {
 	Vec3D normal = *normal_pointer;
 	Point3D off = *off_pointer;
-	Vec3D random_direction = normal + random_unit_vector(prng_state);
+	u32 num_draws = 0;
+	Vec3D random_direction = normal + random_unit_vector(prng_state, &num_draws);
+	count_unit_sphere_draws(path_stats, num_draws);
 	return (Ray) {off, random_direction};
 }
 
@@ -39,13 +51,17 @@ inline Ray fuzzy_reflect(
 	Ray *ray,
 	Vec3D *normal_pointer,
 	Point3D *off_pointer,
-	f32 scatter_index
+	f32 scatter_index,
+	PathStats *path_stats
 ) {
 	Vec3D direction = ray->direction;
 	Vec3D normal = *normal_pointer;
 	Point3D off = *off_pointer;
 	Vec3D reflected = direction - (2 * dot(&direction, &normal) * normal);
-	Vec3D fuzzy_reflected = reflected + (scatter_index * random_unit_sphere_vector(prng_state));
+	u32 num_draws = 0;
+	Vec3D fuzz = random_unit_sphere_vector(prng_state, &num_draws);
+	count_unit_sphere_draws(path_stats, num_draws);
+	Vec3D fuzzy_reflected = reflected + (scatter_index * fuzz);
 	return (Ray) {off, fuzzy_reflected};
 }
 
@@ -61,7 +77,8 @@ inline Ray refract(
 	Vec3D *normal_p,
 	Point3D *off_p,
 	bool inside,
-	f32 refractive_index
+	f32 refractive_index,
+	PathStats *path_stats
 ) {
 	Vec3D normal = *normal_p;
 	Point3D off = *off_p;
@@ -72,26 +89,39 @@ inline Ray refract(
 	f32 sin_theta = sqrt(1.0 - (cos_theta * cos_theta));
 	if ((refraction_ratio * sin_theta) > 1.0) {
 		// must reflect
+		count_path_event(path_stats, PATH_EVENT_TOTAL_INTERNAL_REFLECTION);
 		return reflect(ray, normal_p, off_p);
 	}
 	f32 reflectivity = schlick(cos_theta, refraction_ratio);
 	f32 reflect_check = unit_uniform(prng_state);
 	if (reflect_check < reflectivity) {
+		count_path_event(path_stats, PATH_EVENT_SCHLICK_REFLECTION);
 		return reflect(ray, normal_p, off_p);
 	}
+	count_path_event(path_stats, PATH_EVENT_REFRACT);
 	Vec3D perpendicular = refraction_ratio * (direction + (cos_theta * normal));
 	Vec3D parallel = -sqrt(fabs(1.0 - l2_norm_squared(&perpendicular))) * normal;
 	Vec3D refracted = parallel + perpendicular;
 	return (Ray) {off, refracted};
 }
 
-inline Ray scatter(PRNGState *prng_state, Ray *ray, Vec3D *normal, Point3D *off, f32 scatter_index) {
+inline Ray scatter(
+	PRNGState *prng_state,
+	Ray *ray,
+	Vec3D *normal,
+	Point3D *off,
+	f32 scatter_index,
+	PathStats *path_stats
+) {
 	if (scatter_index == 1.0) {
-		return diffuse_bounce(prng_state, ray, normal, off);
+		count_path_event(path_stats, PATH_EVENT_DIFFUSE);
+		return diffuse_bounce(prng_state, ray, normal, off, path_stats);
 	} else if (scatter_index == 0.0) {
+		count_path_event(path_stats, PATH_EVENT_MIRROR);
 		return reflect(ray, normal, off);
 	} else {
-		return fuzzy_reflect(prng_state, ray, normal, off, scatter_index);
+		count_path_event(path_stats, PATH_EVENT_FUZZY);
+		return fuzzy_reflect(prng_state, ray, normal, off, scatter_index, path_stats);
 	}
 }
 
@@ -143,6 +173,120 @@ inline IntersectionResult intersect_sphere(Ray *ray, Sphere *sphere) {
 	return result;
 }
 
+// Fill in the hit point and normal for a sphere we already know was hit at t
+inline void finish_sphere_hit(
+	Ray *ray,
+	Point3D *center,
+	f32 radius,
+	u32 material_index,
+	f32 t,
+	Intersection *intersection
+) {
+	Point3D point = ray_at(ray, t);
+	Vec3D normal = (point - *center) / radius;
+	intersection->inside = false;
+	if (dot(&normal, &ray->direction) > 0.0) {
+		intersection->inside = true;
+		normal = -normal;
+	}
+	intersection->origin = point;
+	intersection->normal = normal;
+	intersection->intersected = true;
+	intersection->material_index = material_index;
+}
+
+// Nearest hit among all spheres in the SoA set that is closer than
+// nearest_distance, same acceptance rules as intersect_sphere. Only the
+// distance and index are tracked here, the caller finishes the winner.
+inline b8 nearest_sphere_soa(Ray *ray, SphereSoA *soa, f32 *nearest_distance, u32 *nearest_index) {
+	f32 a = dot(&ray->direction, &ray->direction);
+	f32 inverse_a = 1.0 / a;
+	f32 best_t = *nearest_distance;
+	u32 best_index = UINT32_MAX;
+#ifdef __AVX2__
+	__m256 ox = _mm256_set1_ps(ray->origin.x);
+	__m256 oy = _mm256_set1_ps(ray->origin.y);
+	__m256 oz = _mm256_set1_ps(ray->origin.z);
+	__m256 dx = _mm256_set1_ps(ray->direction.x);
+	__m256 dy = _mm256_set1_ps(ray->direction.y);
+	__m256 dz = _mm256_set1_ps(ray->direction.z);
+	__m256 va = _mm256_set1_ps(a);
+	__m256 vinverse_a = _mm256_set1_ps(inverse_a);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 reject_eps = _mm256_set1_ps(1e-2);
+	__m256 near_eps = _mm256_set1_ps(1e-4);
+	__m256i count = _mm256_set1_epi32((i32) soa->count);
+	__m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i lane_step = _mm256_set1_epi32(SPHERE_SOA_WIDTH);
+	__m256 lane_best_t = _mm256_set1_ps(best_t);
+	__m256i lane_best_index = _mm256_set1_epi32(-1);
+	for (u32 i = 0; i < soa->padded_count; i += SPHERE_SOA_WIDTH) {
+		__m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(soa->x + i));
+		__m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(soa->y + i));
+		__m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(soa->z + i));
+		__m256 r = _mm256_loadu_ps(soa->radius + i);
+		__m256 b = _mm256_fmadd_ps(sx, dx, _mm256_fmadd_ps(sy, dy, _mm256_mul_ps(sz, dz)));
+		__m256 c = _mm256_fmsub_ps(sx, sx, _mm256_fmsub_ps(r, r, _mm256_fmadd_ps(sy, sy, _mm256_mul_ps(sz, sz))));
+		__m256 discriminant = _mm256_fnmadd_ps(va, c, _mm256_mul_ps(b, b));
+		__m256 discriminant_sqrt = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+		__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), discriminant_sqrt), vinverse_a);
+		__m256 t1 = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(zero, b), discriminant_sqrt), vinverse_a);
+		// t1 >= t0, so both being too close reduces to t1 being too close
+		__m256 t = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, near_eps, _CMP_GE_OQ));
+		__m256 valid = _mm256_and_ps(
+			_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ),
+			_mm256_cmp_ps(t1, reject_eps, _CMP_GE_OQ)
+		);
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, lane_best_t, _CMP_LT_OQ));
+		valid = _mm256_and_ps(valid, _mm256_castsi256_ps(_mm256_cmpgt_epi32(count, lane_index)));
+		lane_best_t = _mm256_blendv_ps(lane_best_t, t, valid);
+		lane_best_index = _mm256_castps_si256(_mm256_blendv_ps(
+			_mm256_castsi256_ps(lane_best_index),
+			_mm256_castsi256_ps(lane_index),
+			valid
+		));
+		lane_index = _mm256_add_epi32(lane_index, lane_step);
+	}
+	f32 lane_t[SPHERE_SOA_WIDTH];
+	i32 lane_i[SPHERE_SOA_WIDTH];
+	_mm256_storeu_ps(lane_t, lane_best_t);
+	_mm256_storeu_si256((__m256i *) lane_i, lane_best_index);
+	for (u32 l = 0; l < SPHERE_SOA_WIDTH; l++) {
+		if ((lane_i[l] >= 0) && (lane_t[l] < best_t)) {
+			best_t = lane_t[l];
+			best_index = (u32) lane_i[l];
+		}
+	}
+#else
+	for (u32 i = 0; i < soa->count; i++) {
+		f32 sx = ray->origin.x - soa->x[i];
+		f32 sy = ray->origin.y - soa->y[i];
+		f32 sz = ray->origin.z - soa->z[i];
+		f32 r = soa->radius[i];
+		f32 b = sx * ray->direction.x + sy * ray->direction.y + sz * ray->direction.z;
+		f32 c = sx * sx + sy * sy + sz * sz - r * r;
+		f32 discriminant = b * b - a * c;
+		if (discriminant < 0.0) {
+			continue;
+		}
+		f32 discriminant_sqrt = sqrt(discriminant);
+		f32 t0 = (-b - discriminant_sqrt) * inverse_a;
+		f32 t1 = (-b + discriminant_sqrt) * inverse_a;
+		f32 t = (t0 >= 1e-4) ? t0 : t1;
+		if ((t1 >= 1e-2) && (t < best_t)) {
+			best_t = t;
+			best_index = i;
+		}
+	}
+#endif
+	if (best_index == UINT32_MAX) {
+		return false;
+	}
+	*nearest_distance = best_t;
+	*nearest_index = best_index;
+	return true;
+}
+
 inline IntersectionResult intersect_plane(Ray *ray, Plane *plane) {
 	IntersectionResult result = {};
 	result.intersected = false;
@@ -166,11 +310,406 @@ inline IntersectionResult intersect_plane(Ray *ray, Plane *plane) {
 	return result;
 }
 
+inline Vec3D safe_inverse_direction(Vec3D *direction) {
+	// NOTE(dd): we're compiling with -ffast-math, so keep the slab test away
+	// from infinities instead of relying on IEEE semantics
+	f32 eps = 1e-12;
+	f32 x = (fabsf(direction->x) > eps) ? direction->x : copysignf(eps, direction->x);
+	f32 y = (fabsf(direction->y) > eps) ? direction->y : copysignf(eps, direction->y);
+	f32 z = (fabsf(direction->z) > eps) ? direction->z : copysignf(eps, direction->z);
+	return (Vec3D) {1.0f / x, 1.0f / y, 1.0f / z};
+}
+
+inline b8 intersect_aabb(AABB *bounds, Point3D *origin, Vec3D *inverse_direction, f32 t_max, f32 *t_entry) {
+	f32 tx0 = (bounds->min.x - origin->x) * inverse_direction->x;
+	f32 tx1 = (bounds->max.x - origin->x) * inverse_direction->x;
+	f32 ty0 = (bounds->min.y - origin->y) * inverse_direction->y;
+	f32 ty1 = (bounds->max.y - origin->y) * inverse_direction->y;
+	f32 tz0 = (bounds->min.z - origin->z) * inverse_direction->z;
+	f32 tz1 = (bounds->max.z - origin->z) * inverse_direction->z;
+	f32 t_near = fmaxf(fmaxf(fminf(tx0, tx1), fminf(ty0, ty1)), fmaxf(fminf(tz0, tz1), 0.0f));
+	f32 t_far = fminf(fminf(fmaxf(tx0, tx1), fmaxf(ty0, ty1)), fminf(fmaxf(tz0, tz1), t_max));
+	*t_entry = t_near;
+	return t_near <= t_far;
+}
+
+inline void intersect_planes(Ray *ray, World *world, Intersection *intersection, f32 *nearest_distance) {
+	u32 num_planes = world->num_planes;
+	for (u32 i = 0; i < num_planes; i++) {
+		Plane *plane = &world->planes[i];
+		IntersectionResult result;
+		result = intersect_plane(ray, plane);
+		if (result.intersected && (result.distance < *nearest_distance)) {
+			*nearest_distance = result.distance;
+			intersection->origin = result.origin;
+			intersection->normal = result.normal;
+			intersection->inside = result.inside;
+			intersection->intersected = true;
+			intersection->material_index = plane->material_index;
+		}
+	}
+}
+
+inline void intersect_bvh(Ray *ray, BVH *bvh, Intersection *intersection, f32 *nearest_distance) {
+	Vec3D inverse_direction = safe_inverse_direction(&ray->direction);
+	u32 stack[BVH_STACK_SIZE];
+	f32 stack_entry[BVH_STACK_SIZE];
+	u32 stack_size = 0;
+	f32 t_entry;
+	if (!intersect_aabb(&bvh->nodes[0].bounds, &ray->origin, &inverse_direction, *nearest_distance, &t_entry)) {
+		return;
+	}
+	u32 node_index = 0;
+	while (true) {
+		BVHNode *node = bvh->nodes + node_index;
+		if (node->count > 0) {
+			for (u32 i = node->offset; i < node->offset + node->count; i++) {
+				Sphere *sphere = &bvh->spheres[i];
+				IntersectionResult result = intersect_sphere(ray, sphere);
+				if (result.intersected && (result.distance < *nearest_distance)) {
+					*nearest_distance = result.distance;
+					intersection->origin = result.origin;
+					intersection->normal = result.normal;
+					intersection->inside = result.inside;
+					intersection->intersected = true;
+					intersection->material_index = sphere->material_index;
+				}
+			}
+		} else {
+			u32 near_index = node_index + 1;
+			u32 far_index = node->offset;
+			f32 t_near;
+			f32 t_far;
+			b8 hit_near = intersect_aabb(&bvh->nodes[near_index].bounds, &ray->origin, &inverse_direction, *nearest_distance, &t_near);
+			b8 hit_far = intersect_aabb(&bvh->nodes[far_index].bounds, &ray->origin, &inverse_direction, *nearest_distance, &t_far);
+			if (hit_near && hit_far) {
+				if (t_far < t_near) {
+					u32 tmp_index = near_index;
+					near_index = far_index;
+					far_index = tmp_index;
+					t_far = t_near;
+				}
+				stack[stack_size] = far_index;
+				stack_entry[stack_size] = t_far;
+				stack_size++;
+				node_index = near_index;
+				continue;
+			} else if (hit_near) {
+				node_index = near_index;
+				continue;
+			} else if (hit_far) {
+				node_index = far_index;
+				continue;
+			}
+		}
+		// pop the next subtree that could still hold a nearer hit
+		b8 found = false;
+		while (stack_size > 0) {
+			stack_size--;
+			if (stack_entry[stack_size] <= *nearest_distance) {
+				node_index = stack[stack_size];
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			return;
+		}
+	}
+}
+
+// Ray entry distances for all children of a wide node, inf for misses.
+// Near planes are picked by the sign of the direction, so the inverted
+// bounds of empty slots can never produce a hit.
+inline void intersect_wide_node(
+	WideBVHNode *node,
+	Point3D *origin,
+	Vec3D *inverse_direction,
+	u32 *near_side,
+	f32 t_max,
+	f32 *t_entry
+) {
+#if defined(__SSE2__) || defined(_M_X64)
+	__m128 t_near_x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->bounds[near_side[0]][0]), _mm_set1_ps(origin->x)), _mm_set1_ps(inverse_direction->x));
+	__m128 t_near_y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->bounds[near_side[1]][1]), _mm_set1_ps(origin->y)), _mm_set1_ps(inverse_direction->y));
+	__m128 t_near_z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->bounds[near_side[2]][2]), _mm_set1_ps(origin->z)), _mm_set1_ps(inverse_direction->z));
+	__m128 t_far_x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->bounds[1 - near_side[0]][0]), _mm_set1_ps(origin->x)), _mm_set1_ps(inverse_direction->x));
+	__m128 t_far_y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->bounds[1 - near_side[1]][1]), _mm_set1_ps(origin->y)), _mm_set1_ps(inverse_direction->y));
+	__m128 t_far_z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node->bounds[1 - near_side[2]][2]), _mm_set1_ps(origin->z)), _mm_set1_ps(inverse_direction->z));
+	__m128 t_near = _mm_max_ps(_mm_max_ps(t_near_x, t_near_y), _mm_max_ps(t_near_z, _mm_setzero_ps()));
+	__m128 t_far = _mm_min_ps(_mm_min_ps(t_far_x, t_far_y), _mm_min_ps(t_far_z, _mm_set1_ps(t_max)));
+	__m128 hit = _mm_cmple_ps(t_near, t_far);
+	_mm_storeu_ps(t_entry, _mm_or_ps(_mm_and_ps(hit, t_near), _mm_andnot_ps(hit, _mm_set1_ps(FLT_MAX))));
+#else
+	for (u32 i = 0; i < WIDE_BVH_WIDTH; i++) {
+		f32 t_near_x = (node->bounds[near_side[0]][0][i] - origin->x) * inverse_direction->x;
+		f32 t_near_y = (node->bounds[near_side[1]][1][i] - origin->y) * inverse_direction->y;
+		f32 t_near_z = (node->bounds[near_side[2]][2][i] - origin->z) * inverse_direction->z;
+		f32 t_far_x = (node->bounds[1 - near_side[0]][0][i] - origin->x) * inverse_direction->x;
+		f32 t_far_y = (node->bounds[1 - near_side[1]][1][i] - origin->y) * inverse_direction->y;
+		f32 t_far_z = (node->bounds[1 - near_side[2]][2][i] - origin->z) * inverse_direction->z;
+		f32 t_near = fmaxf(fmaxf(t_near_x, t_near_y), fmaxf(t_near_z, 0.0f));
+		f32 t_far = fminf(fminf(t_far_x, t_far_y), fminf(t_far_z, t_max));
+		t_entry[i] = (t_near <= t_far) ? t_near : FLT_MAX;
+	}
+#endif
+}
+
+inline void intersect_wide_bvh(Ray *ray, WideBVH *wide, Intersection *intersection, f32 *nearest_distance) {
+	Vec3D inverse_direction = safe_inverse_direction(&ray->direction);
+	u32 near_side[3] = {
+		inverse_direction.x < 0.0f,
+		inverse_direction.y < 0.0f,
+		inverse_direction.z < 0.0f,
+	};
+	u32 stack_child[WIDE_BVH_STACK_SIZE];
+	u16 stack_count[WIDE_BVH_STACK_SIZE];
+	f32 stack_entry[WIDE_BVH_STACK_SIZE];
+	u32 stack_size = 1;
+	stack_child[0] = 0;
+	stack_count[0] = 0;
+	stack_entry[0] = 0.0;
+	while (stack_size > 0) {
+		stack_size--;
+		if (stack_entry[stack_size] > *nearest_distance) {
+			continue;
+		}
+		u32 child = stack_child[stack_size];
+		u16 count = stack_count[stack_size];
+		if (count > 0) {
+			for (u32 i = child; i < child + count; i++) {
+				Sphere *sphere = &wide->spheres[i];
+				IntersectionResult result = intersect_sphere(ray, sphere);
+				if (result.intersected && (result.distance < *nearest_distance)) {
+					*nearest_distance = result.distance;
+					intersection->origin = result.origin;
+					intersection->normal = result.normal;
+					intersection->inside = result.inside;
+					intersection->intersected = true;
+					intersection->material_index = sphere->material_index;
+				}
+			}
+			continue;
+		}
+		WideBVHNode *node = wide->nodes + child;
+		f32 t_entry[WIDE_BVH_WIDTH];
+		intersect_wide_node(node, &ray->origin, &inverse_direction, near_side, *nearest_distance, t_entry);
+		// push hit children far to near so the nearest one is popped next
+		u32 order[WIDE_BVH_WIDTH];
+		u32 num_hits = 0;
+		for (u32 i = 0; i < WIDE_BVH_WIDTH; i++) {
+			if (t_entry[i] == FLT_MAX) {
+				continue;
+			}
+			u32 j = num_hits++;
+			while ((j > 0) && (t_entry[order[j - 1]] < t_entry[i])) {
+				order[j] = order[j - 1];
+				j--;
+			}
+			order[j] = i;
+		}
+		for (u32 i = 0; i < num_hits; i++) {
+			u32 slot = order[i];
+			stack_child[stack_size] = node->child[slot];
+			stack_count[stack_size] = node->count[slot];
+			stack_entry[stack_size] = t_entry[slot];
+			stack_size++;
+		}
+	}
+}
+
+// Any-hit versions of the queries above for shadow and visibility rays.
+// They only answer whether something sits in front of t_max along the ray,
+// so they stop at the first hit and never build a normal or figure out
+// which side was hit. Sphere acceptance matches intersect_sphere.
+inline b8 sphere_blocks(Ray *ray, Sphere *sphere, f32 t_max) {
+	Point3D shifted_origin = ray->origin - sphere->origin;
+	f32 a = dot(&ray->direction, &ray->direction);
+	f32 b = dot(&shifted_origin, &ray->direction);
+	f32 c = dot(&shifted_origin, &shifted_origin) - sphere->radius * sphere->radius;
+	f32 discriminant = b * b - a * c;
+	if (discriminant < 0.0) {
+		return false;
+	}
+	f32 discriminant_sqrt = sqrt(discriminant);
+	f32 t0 = (-b - discriminant_sqrt) / a;
+	f32 t1 = (-b + discriminant_sqrt) / a;
+	f32 t = (t0 >= 1e-4) ? t0 : t1;
+	return (t1 >= 1e-2) && (t < t_max);
+}
+
+inline b8 any_sphere_soa(Ray *ray, SphereSoA *soa, f32 t_max) {
+	f32 a = dot(&ray->direction, &ray->direction);
+	f32 inverse_a = 1.0 / a;
+#ifdef __AVX2__
+	__m256 ox = _mm256_set1_ps(ray->origin.x);
+	__m256 oy = _mm256_set1_ps(ray->origin.y);
+	__m256 oz = _mm256_set1_ps(ray->origin.z);
+	__m256 dx = _mm256_set1_ps(ray->direction.x);
+	__m256 dy = _mm256_set1_ps(ray->direction.y);
+	__m256 dz = _mm256_set1_ps(ray->direction.z);
+	__m256 va = _mm256_set1_ps(a);
+	__m256 vinverse_a = _mm256_set1_ps(inverse_a);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 reject_eps = _mm256_set1_ps(1e-2);
+	__m256 near_eps = _mm256_set1_ps(1e-4);
+	__m256 vt_max = _mm256_set1_ps(t_max);
+	__m256i count = _mm256_set1_epi32((i32) soa->count);
+	__m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i lane_step = _mm256_set1_epi32(SPHERE_SOA_WIDTH);
+	for (u32 i = 0; i < soa->padded_count; i += SPHERE_SOA_WIDTH) {
+		__m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(soa->x + i));
+		__m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(soa->y + i));
+		__m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(soa->z + i));
+		__m256 r = _mm256_loadu_ps(soa->radius + i);
+		__m256 b = _mm256_fmadd_ps(sx, dx, _mm256_fmadd_ps(sy, dy, _mm256_mul_ps(sz, dz)));
+		__m256 c = _mm256_fmsub_ps(sx, sx, _mm256_fmsub_ps(r, r, _mm256_fmadd_ps(sy, sy, _mm256_mul_ps(sz, sz))));
+		__m256 discriminant = _mm256_fnmadd_ps(va, c, _mm256_mul_ps(b, b));
+		__m256 discriminant_sqrt = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+		__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), discriminant_sqrt), vinverse_a);
+		__m256 t1 = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(zero, b), discriminant_sqrt), vinverse_a);
+		__m256 t = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, near_eps, _CMP_GE_OQ));
+		__m256 valid = _mm256_and_ps(
+			_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ),
+			_mm256_cmp_ps(t1, reject_eps, _CMP_GE_OQ)
+		);
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, vt_max, _CMP_LT_OQ));
+		valid = _mm256_and_ps(valid, _mm256_castsi256_ps(_mm256_cmpgt_epi32(count, lane_index)));
+		if (_mm256_movemask_ps(valid)) {
+			return true;
+		}
+		lane_index = _mm256_add_epi32(lane_index, lane_step);
+	}
+#else
+	for (u32 i = 0; i < soa->count; i++) {
+		f32 sx = ray->origin.x - soa->x[i];
+		f32 sy = ray->origin.y - soa->y[i];
+		f32 sz = ray->origin.z - soa->z[i];
+		f32 r = soa->radius[i];
+		f32 b = sx * ray->direction.x + sy * ray->direction.y + sz * ray->direction.z;
+		f32 c = sx * sx + sy * sy + sz * sz - r * r;
+		f32 discriminant = b * b - a * c;
+		if (discriminant < 0.0) {
+			continue;
+		}
+		f32 discriminant_sqrt = sqrt(discriminant);
+		f32 t0 = (-b - discriminant_sqrt) * inverse_a;
+		f32 t1 = (-b + discriminant_sqrt) * inverse_a;
+		f32 t = (t0 >= 1e-4) ? t0 : t1;
+		if ((t1 >= 1e-2) && (t < t_max)) {
+			return true;
+		}
+	}
+#endif
+	return false;
+}
+
+// NOTE(dd): unlike intersect_planes this only counts planes in front of the
+// origin, a shadow ray should never be blocked by something behind it
+inline b8 any_plane(Ray *ray, World *world, f32 t_max) {
+	for (u32 i = 0; i < world->num_planes; i++) {
+		Plane *plane = &world->planes[i];
+		f32 cos_theta = dot(&plane->normal, &ray->direction);
+		if ((cos_theta < -1e-3) > (cos_theta > 1e-3)) {
+			continue;
+		}
+		f32 t = (-plane->distance - dot(&plane->normal, &ray->origin)) / cos_theta;
+		if ((t > 1e-4) && (t < t_max)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// No front to back ordering, any leaf that holds a hit ends the search
+inline b8 any_bvh(Ray *ray, BVH *bvh, f32 t_max) {
+	Vec3D inverse_direction = safe_inverse_direction(&ray->direction);
+	u32 stack[BVH_STACK_SIZE];
+	u32 stack_size = 1;
+	stack[0] = 0;
+	while (stack_size > 0) {
+		BVHNode *node = bvh->nodes + stack[--stack_size];
+		f32 t_entry;
+		if (!intersect_aabb(&node->bounds, &ray->origin, &inverse_direction, t_max, &t_entry)) {
+			continue;
+		}
+		if (node->count > 0) {
+			for (u32 i = node->offset; i < node->offset + node->count; i++) {
+				if (sphere_blocks(ray, &bvh->spheres[i], t_max)) {
+					return true;
+				}
+			}
+			continue;
+		}
+		stack[stack_size++] = node->offset;
+		stack[stack_size++] = (u32) (node - bvh->nodes) + 1;
+	}
+	return false;
+}
+
+inline b8 any_wide_bvh(Ray *ray, WideBVH *wide, f32 t_max) {
+	Vec3D inverse_direction = safe_inverse_direction(&ray->direction);
+	u32 near_side[3] = {
+		inverse_direction.x < 0.0f,
+		inverse_direction.y < 0.0f,
+		inverse_direction.z < 0.0f,
+	};
+	u32 stack_child[WIDE_BVH_STACK_SIZE];
+	u16 stack_count[WIDE_BVH_STACK_SIZE];
+	u32 stack_size = 1;
+	stack_child[0] = 0;
+	stack_count[0] = 0;
+	while (stack_size > 0) {
+		stack_size--;
+		u32 child = stack_child[stack_size];
+		u16 count = stack_count[stack_size];
+		if (count > 0) {
+			for (u32 i = child; i < child + count; i++) {
+				if (sphere_blocks(ray, &wide->spheres[i], t_max)) {
+					return true;
+				}
+			}
+			continue;
+		}
+		WideBVHNode *node = wide->nodes + child;
+		f32 t_entry[WIDE_BVH_WIDTH];
+		intersect_wide_node(node, &ray->origin, &inverse_direction, near_side, t_max, t_entry);
+		for (u32 i = 0; i < WIDE_BVH_WIDTH; i++) {
+			if (t_entry[i] == FLT_MAX) {
+				continue;
+			}
+			stack_child[stack_size] = node->child[i];
+			stack_count[stack_size] = node->count[i];
+			stack_size++;
+		}
+	}
+	return false;
+}
+
 inline Intersection find_intersection(Ray *ray, World *world) {
 	Intersection intersection = {};
 	u32 num_spheres = world->num_spheres;
-	u32 num_planes = world->num_planes;
 	f32 nearest_distance = (f32) UINT32_MAX;
+	// NOTE(dd): planes are unbounded, so they always get tested and their
+	// distance seeds the culling distance for the sphere hierarchy
+	intersect_planes(ray, world, &intersection, &nearest_distance);
+	if (world->wide_bvh) {
+		intersect_wide_bvh(ray, world->wide_bvh, &intersection, &nearest_distance);
+		return intersection;
+	}
+	if (world->bvh) {
+		intersect_bvh(ray, world->bvh, &intersection, &nearest_distance);
+		return intersection;
+	}
+	if (world->sphere_soa) {
+		SphereSoA *soa = world->sphere_soa;
+		u32 i;
+		if (nearest_sphere_soa(ray, soa, &nearest_distance, &i)) {
+			Point3D center = {soa->x[i], soa->y[i], soa->z[i]};
+			finish_sphere_hit(ray, &center, soa->radius[i], soa->material_index[i], nearest_distance, &intersection);
+		}
+		return intersection;
+	}
 	// TODO(dd): try out unions with type enums again, measure perf
 	for (u32 i = 0; i < num_spheres; i++) {
 		Sphere *sphere = &world->spheres[i];
@@ -185,39 +724,148 @@ inline Intersection find_intersection(Ray *ray, World *world) {
 			intersection.material_index = sphere->material_index;
 		}
 	}
-	for (u32 i = 0; i < num_planes; i++) {
-		Plane *plane = &world->planes[i];
-		IntersectionResult result;
-		result = intersect_plane(ray, plane);
-		if (result.intersected && (result.distance < nearest_distance)) {
-			nearest_distance = result.distance;
-			intersection.origin = result.origin;
-			intersection.normal = result.normal;
-			intersection.inside = result.inside;
-			intersection.intersected = true;
-			intersection.material_index = plane->material_index;
+	return intersection;
+}
+
+// Whether anything blocks the ray before distance t_max, in units of the
+// ray direction like every other distance here
+inline b8 occluded(Ray *ray, World *world, f32 t_max) {
+	if (any_plane(ray, world, t_max)) {
+		return true;
+	}
+	if (world->wide_bvh) {
+		return any_wide_bvh(ray, world->wide_bvh, t_max);
+	}
+	if (world->bvh) {
+		return any_bvh(ray, world->bvh, t_max);
+	}
+	if (world->sphere_soa) {
+		return any_sphere_soa(ray, world->sphere_soa, t_max);
+	}
+	for (u32 i = 0; i < world->num_spheres; i++) {
+		if (sphere_blocks(ray, &world->spheres[i], t_max)) {
+			return true;
 		}
 	}
-	return intersection;
+	return false;
 }
 
-inline Ray prime_ray(PRNGState *prng_state, Camera *camera, f32 row_frac, f32 col_frac) {
-	Vec3D basis1 = cross(&camera->up, &camera->normal);
-	basis1 = normalize(&basis1);
-	Vec3D basis2 = cross(&camera->normal, &basis1);
-	f32 lens_radius = camera->aperture / 2.0;
-	Vec3D random_lens_offset = lens_radius * random_unit_vector(prng_state);
-	random_lens_offset = (basis1 * random_lens_offset.x) + (basis2 * random_lens_offset.y);
-	Point3D top_left = (camera->origin
-		- (camera->focal_distance * camera->image_plane.width * basis1 / 2.0)
-		+ (camera->focal_distance * camera->image_plane.height * basis2 / 2.0)
-		- (camera->focal_distance * camera->normal));
-	Vec3D direction = (top_left
-		+ (camera->focal_distance * basis1 * col_frac * camera->image_plane.width)
-		- (camera->focal_distance * basis2 * row_frac * camera->image_plane.height)
-		- camera->origin
-		- random_lens_offset);
-	return (Ray) {camera->origin + random_lens_offset, direction};
+// row and col are in pixels, fractional for jitter. Everything per camera
+// lives in PreparedCamera, so a pinhole ray is just the two pixel steps.
+inline Ray prime_ray(PRNGState *prng_state, PreparedCamera *camera, f32 row, f32 col, PathStats *path_stats) {
+	Vec3D direction = camera->pixel_origin + (camera->pixel_right * col) + (camera->pixel_down * row);
+	if (camera->lens_radius == 0.0) {
+		return (Ray) {camera->origin, direction};
+	}
+	u32 num_draws = 0;
+	Vec3D random_lens_offset = random_unit_vector(prng_state, &num_draws);
+	count_unit_sphere_draws(path_stats, num_draws);
+	random_lens_offset = (camera->lens_right * random_lens_offset.x) + (camera->lens_up * random_lens_offset.y);
+	return (Ray) {camera->origin + random_lens_offset, direction - random_lens_offset};
+}
+
+// One jittered ray per pixel for count pixels of a row starting at col_min,
+// same random draws in the same order as calling prime_ray on each
+inline void prime_ray_row(
+	PRNGState *prng_state,
+	PreparedCamera *camera,
+	u32 row,
+	u32 col_min,
+	u32 count,
+	Ray *rays,
+	PathStats *path_stats
+) {
+	Vec3D row_origin = (camera->pixel_origin
+		+ (camera->pixel_down * ((f32) row + 0.5f))
+		+ (camera->pixel_right * ((f32) col_min + 0.5f)));
+	for (u32 k = 0; k < count; k++) {
+		f32 row_rand = unit_uniform(prng_state);
+		f32 col_rand = unit_uniform(prng_state);
+		Vec3D direction = row_origin + (camera->pixel_down * row_rand) + (camera->pixel_right * ((f32) k + col_rand));
+		rays[k].origin = camera->origin;
+		rays[k].direction = direction;
+		if (camera->lens_radius != 0.0) {
+			u32 num_draws = 0;
+			Vec3D random_lens_offset = random_unit_vector(prng_state, &num_draws);
+			count_unit_sphere_draws(path_stats, num_draws);
+			random_lens_offset = (camera->lens_right * random_lens_offset.x) + (camera->lens_up * random_lens_offset.y);
+			rays[k].origin = camera->origin + random_lens_offset;
+			rays[k].direction = direction - random_lens_offset;
+		}
+	}
+}
+
+// Light arriving at a diffuse hit straight from one randomly picked light,
+// weighted against the chance of the bounced ray finding that light itself
+inline RGBA sample_direct_light(
+	PRNGState *prng_state,
+	World *world,
+	Point3D *point,
+	Vec3D *normal,
+	u32 *num_traced_rays
+) {
+	RGBA black = {0.0, 0.0, 0.0, 0.0};
+	u32 light_index = (u32) (unit_uniform(prng_state) * world->num_lights);
+	if (light_index >= world->num_lights) {
+		light_index = world->num_lights - 1;
+	}
+	Sphere *light = world->lights + light_index;
+	LightSample sample;
+	if (!sample_light_cone(prng_state, point, light, &sample)) {
+		return black;
+	}
+	f32 cos_theta = dot(&sample.direction, normal);
+	if (cos_theta <= 0.0) {
+		return black;
+	}
+	Ray shadow_ray = {*point, sample.direction};
+	IntersectionResult light_hit = intersect_sphere(&shadow_ray, light);
+	if (!light_hit.intersected) {
+		return black;
+	}
+	*num_traced_rays += 1;
+	if (occluded(&shadow_ray, world, light_hit.distance * 0.999)) {
+		return black;
+	}
+	f32 light_pdf = sample.pdf / (f32) world->num_lights;
+	f32 bsdf_pdf = cos_theta / M_PI;
+	RGBA emit = world->materials[light->material_index].emit;
+	// lambertian f * cos / pdf, the albedo is already in the attenuation
+	return emit * (mis_weight(light_pdf, bsdf_pdf) * bsdf_pdf / light_pdf);
+}
+
+// Density of light sampling picking the emitter a bounced ray just hit, or 0
+// if what we hit isn't in the light list (e.g. an emissive plane)
+inline f32 hit_light_pdf(World *world, Point3D *from, Intersection *intersection) {
+	for (u32 l = 0; l < world->num_lights; l++) {
+		Sphere *light = world->lights + l;
+		if (light->material_index != intersection->material_index) {
+			continue;
+		}
+		Vec3D offset = intersection->origin - light->origin;
+		f32 distance = l2_norm(&offset);
+		if (fabs(distance - fabs(light->radius)) <= 1e-3 * fabs(light->radius)) {
+			return light_cone_pdf(from, light) / (f32) world->num_lights;
+		}
+	}
+	return 0.0;
+}
+
+// Russian roulette: end the path with probability 1 - p, with p the largest
+// channel of its throughput, and boost the survivors by 1 / p so the
+// expected value is unchanged. Alpha is left alone.
+inline b8 survive_roulette(PRNGState *prng_state, RGBA *attenuation) {
+	f32 p = fmax(attenuation->r, fmax(attenuation->g, attenuation->b));
+	if (p >= 1.0) {
+		return true;
+	}
+	if (unit_uniform(prng_state) >= p) {
+		return false;
+	}
+	attenuation->r /= p;
+	attenuation->g /= p;
+	attenuation->b /= p;
+	return true;
 }
 
 inline RGBA trace(
@@ -225,169 +873,68 @@ inline RGBA trace(
 	RGBA *background,
 	Ray *ray,
 	World *world,
-	RenderQueue *render_queue,
+	RenderSettings *settings,
 	u32 *num_traced_rays,
-	u32 depth
+	u32 *num_segments,
+	u32 depth,
+	PathStats *path_stats // NULL unless counting
 ) {
 	RGBA color = {0.0, 0.0, 0.0, 1.0};
 	RGBA attenuation = {1.0, 1.0, 1.0, 1.0};
+	b8 light_sampling = settings->light_sampling && (world->num_lights > 0);
+	b8 russian_roulette = settings->russian_roulette;
+	u32 roulette_depth = settings->roulette_depth ? settings->roulette_depth : DEFAULT_ROULETTE_DEPTH;
+	// set when the last bounce was diffuse and light sampling already
+	// covered part of what this ray could find
+	b8 after_diffuse = false;
+	f32 bsdf_pdf = 0.0;
+	Point3D previous_point = {};
 	for (u32 d = 0; d < depth; d++) {
 		*num_traced_rays += 1;
+		*num_segments += 1;
 		Intersection intersection = find_intersection(ray, world);
 		if (!intersection.intersected) {
 			color += attenuation * *background;
-			break;
+			count_path_end(path_stats, PATH_END_ESCAPED, d + 1);
+			return color;
 		}
 		Material material = world->materials[intersection.material_index];
 		Point3D intersection_point = intersection.origin;
 		Vec3D normal = intersection.normal;
 		bool inside = intersection.inside;
-		color += attenuation * material.emit;
+		if (after_diffuse && is_emissive(&material)) {
+			f32 light_pdf = hit_light_pdf(world, &previous_point, &intersection);
+			color += attenuation * material.emit * mis_weight(bsdf_pdf, light_pdf);
+		} else {
+			color += attenuation * material.emit;
+		}
 		attenuation *= material.color;
+		after_diffuse = false;
 		if (material.refractive_index > 0.0) {
-			*ray = refract(prng_state, ray, &normal, &intersection_point, inside, material.refractive_index);
+			*ray = refract(prng_state, ray, &normal, &intersection_point, inside, material.refractive_index, path_stats);
 		} else {
-			*ray = scatter(prng_state, ray, &normal, &intersection_point, material.scatter_index);
-		}
-	}
-	return color;
-}
-
-inline b8 render_tile(RenderQueue *render_queue) {
-	u64 job_index = sync_fetch_and_add(&render_queue->next_job_index, 1);
-	if (job_index >= render_queue->num_tiles) {
-		return false;
-	}
-	RenderJob *render_job = render_queue->jobs + job_index;
-	PRNGState *prng_state = &render_job->prng_state;
-	RGBA *background = render_job->background;
-	World *world = render_job->world;
-	Camera *camera = render_job->camera;
-	u32 rows = render_job->rows;
-	u32 cols = render_job->cols;
-	u32 row_min = render_job->row_min;
-	u32 row_max = render_job->row_max;
-	u32 col_min = render_job->col_min;
-	u32 col_max = render_job->col_max;
-	u32 num_samples = render_job->num_samples;
-	u32 max_depth = render_job->max_depth;
-	u32 *out = render_job->out;
-	u32 tile_rows = row_max - row_min;
-	u32 tile_cols = col_max - col_min;
-	u32 num_traced_rays = 0;
-	for (u32 i = row_min; i < row_max; i++) {
-		for (u32 j = col_min; j < col_max; j++) {
-			RGBA color = {0.0, 0.0, 0.0, 1.0};
-			for (u32 s = 0; s < num_samples; s++) {
-				f32 row_rand = unit_uniform(prng_state);
-				f32 col_rand = unit_uniform(prng_state);
-				f32 u = ((f32) i + 0.5 + row_rand) / ((f32) rows);
-				f32 v = ((f32) j + 0.5 + col_rand) / ((f32) cols);
-				Ray ray = prime_ray(prng_state, camera, u, v);
-				color += trace(
+			*ray = scatter(prng_state, ray, &normal, &intersection_point, material.scatter_index, path_stats);
+			if (light_sampling && (material.scatter_index == 1.0)) {
+				color += attenuation * sample_direct_light(
 					prng_state,
-					background,
-					&ray,
 					world,
-					render_queue,
-					&num_traced_rays,
-					max_depth
+					&intersection_point,
+					&normal,
+					num_traced_rays
 				);
+				Vec3D direction = normalize(&ray->direction);
+				bsdf_pdf = fmax(dot(&direction, &normal), 0.0) / M_PI;
+				previous_point = intersection_point;
+				after_diffuse = true;
 			}
-			color = color / (f32) num_samples;
-			u32 color_u32 = rgba_to_u32(&color);
-			out[i * cols + j] = color_u32;
 		}
-	}
-	sync_fetch_and_add(&render_queue->ray_count, num_traced_rays);
-	sync_fetch_and_add(&render_queue->tile_rendered_count, 1);
-	return true;
-}
-
-inline threaded render_thread(void *args) {
-	RenderQueue *render_queue = (RenderQueue *) args;
-	f32 progress = 0.0;
-	while(render_tile(render_queue)) {};
-	return 0;
-}
-
-inline f32 render(
-	World *world,
-	Camera *camera,
-	RGBA *background,
-	u32 rows,
-	u32 cols,
-	u32 tile_rows,
-	u32 tile_cols,
-	u32 num_samples,
-	u32 max_depth,
-	u32 num_threads
-) {
-	u32 *image = imalloc(rows, cols);
-	u32 *out = image;
-	u32 pixel_count = rows * cols;
-	u32 num_tiles = ((rows + tile_rows - 1) / tile_rows)
-		* ((cols + tile_cols - 1) / tile_cols);
-	RenderQueue render_queue = {};
-	render_queue.jobs = (RenderJob *)malloc(sizeof(RenderJob) * num_tiles);
-	printf("\n[start] rendering %dpx x %dpx (width x height) image with %dpx x %dpx tiles\n", cols, rows, tile_cols, tile_rows);
-	for (u32 i = 0; i < rows; i += tile_rows) {
-		u32 row_min = i;
-		u32 row_max = row_min + tile_rows;
-		if (row_max > rows) {
-			row_max = rows;
-		}
-		for (u32 j = 0; j < cols; j += tile_cols) {
-			u32 col_min = j;
-			u32 col_max = col_min + tile_cols;
-			if (col_max > cols) {
-				col_max = cols;
-			}
-			RenderJob *render_job = render_queue.jobs + render_queue.num_tiles++;
-			PRNGState prng_state = {read_entropy()};
-			warm_up_xor_shift(&prng_state);
-			render_job->prng_state = prng_state;
-			render_job->background = background;
-			render_job->world = world;
-			render_job->camera = camera;
-			render_job->rows = rows;
-			render_job->cols = cols;
-			render_job->row_min = row_min;
-			render_job->row_max = row_max;
-			render_job->col_min = col_min;
-			render_job->col_max = col_max;
-			render_job->num_samples = num_samples;
-			render_job->max_depth = max_depth;
-			render_job->out = out;
+		if (russian_roulette && (d + 1 >= roulette_depth) && !survive_roulette(prng_state, &attenuation)) {
+			count_path_end(path_stats, PATH_END_ROULETTE, d + 1);
+			return color;
 		}
 	}
-	// memory fence here, before we modify this from threads
-	sync_fetch_and_add(&render_queue.next_job_index, 0);
-	f64 sc = tick();
-	ThreadHandle threads[num_threads];
-	for (u32 i = 0; i < num_threads; i++) {
-		ThreadHandle thread = create_thread(render_thread, (void *) &render_queue);
-		threads[i] = thread;
-	}
-	f32 progress = 0.0;
-	while (render_tile(&render_queue)) {
-		progress = ((f32) render_queue.tile_rendered_count
-			/ (f32) render_queue.num_tiles);
-		printf("[running] rendered %.2f%%...\n", progress * 100.0);
-	};
-	for (u32 i = num_threads - 1; i > 0; i--) {
-		join_thread(threads[i]);
-	}
-	f64 ec = tick();
-	f64 dc = ec - sc;
-	f32 ray_count = (f32) render_queue.ray_count;
-	printf("[info] processed %llu rays\n", (u64) ray_count);
-	printf("[info] scene rendered in %.9f seconds on %d threads\n", dc, num_threads + 1);
-	printf("[info] rendered %.2f Mrays/s\n", (ray_count / 1.0e6) / dc);
-	printf("[info] ray timing: %.10f ms/ray \n", (dc * 1000.0) / ray_count);
-	printf("[info] writing image...\n");
-	stbi_write_bmp("image.bmp", cols, rows, 4, image);
-	printf("[ok] done!\n");
-	return ray_count;
+	count_path_end(path_stats, PATH_END_MAX_DEPTH, depth);
+	return color;
 }
+
 #endif // YELLOW_RAY
@@ -0,0 +1,665 @@
+#ifndef YELLOW_RENDER
+#define YELLOW_RENDER
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "types.h"
+#include "colors.h"
+#include "materials.h"
+#include "cameras.h"
+#include "threads.h"
+#include "ray.h"
+#include "wavefront.h"
+#include "profile.h"
+#include "counters.h"
+#include "stats.h"
+#include "writer.h"
+#include "checkpoint.h"
+#include "scenefile.h"
+
+inline f32 luminance(RGBA *color) {
+	return 0.2126 * color->r + 0.7152 * color->g + 0.0722 * color->b;
+}
+
+// Whether the standard error of the mean luminance is below threshold times
+// the mean: variance / s < (threshold * mean)^2, with variance = m2 / (s - 1)
+inline b8 adaptive_converged(f32 mean, f32 m2, u32 s, f32 threshold_squared) {
+	f32 error_squared = m2 / ((f32) (s - 1) * (f32) s);
+	return error_squared <= threshold_squared * mean * mean;
+}
+
+// Trace the samples of every pixel in the tile depth first, one path at a
+// time, until each pixel has num_samples in the film. With adaptive sampling
+// on, a pixel stops early once its running variance says the mean has
+// converged, and stays stopped in later passes.
+inline void render_tile_paths(RenderJob *render_job, TileStats *tile_stats, PathStats *path_stats) {
+	PRNGState *prng_state = &render_job->prng_state;
+	RGBA *background = render_job->background;
+	World *world = render_job->world;
+	PreparedCamera *camera = render_job->camera;
+	RenderSettings *settings = render_job->settings;
+	Film *film = render_job->film;
+	u32 cols = render_job->cols;
+	u32 row_min = render_job->row_min;
+	u32 row_max = render_job->row_max;
+	u32 col_min = render_job->col_min;
+	u32 col_max = render_job->col_max;
+	u32 num_samples = render_job->num_samples;
+	u32 max_depth = render_job->max_depth;
+	u32 *out = render_job->out;
+	b8 adaptive = settings->adaptive;
+	f32 threshold = settings->adaptive_threshold ? settings->adaptive_threshold : DEFAULT_ADAPTIVE_THRESHOLD;
+	u32 min_samples = settings->min_samples ? settings->min_samples : DEFAULT_MIN_SAMPLES;
+	f32 threshold_squared = threshold * threshold;
+	u32 num_traced_rays = 0;
+	u32 num_segments = 0;
+	u64 num_taken_samples = 0;
+	for (u32 i = row_min; i < row_max; i++) {
+		for (u32 j = col_min; j < col_max; j++) {
+			u64 index = film_index(film, i, j);
+			RGBA color = film->sums[index];
+			u32 s = film->counts[index];
+			u32 first_sample = s;
+			// Welford's running mean and sum of squared deviations
+			f32 mean = adaptive ? film->means[index] : 0.0;
+			f32 m2 = adaptive ? film->m2s[index] : 0.0;
+			b8 converged = adaptive && (s >= min_samples) && adaptive_converged(mean, m2, s, threshold_squared);
+			while (!converged && (s < num_samples)) {
+				f32 row_rand = unit_uniform(prng_state);
+				f32 col_rand = unit_uniform(prng_state);
+				Ray ray = prime_ray(prng_state, camera, (f32) i + 0.5 + row_rand, (f32) j + 0.5 + col_rand, path_stats);
+				RGBA sample = trace(
+					prng_state,
+					background,
+					&ray,
+					world,
+					settings,
+					&num_traced_rays,
+					&num_segments,
+					max_depth,
+					path_stats
+				);
+				color += sample;
+				s++;
+				if (!adaptive) {
+					continue;
+				}
+				f32 y = luminance(&sample);
+				f32 delta = y - mean;
+				mean += delta / (f32) s;
+				m2 += delta * (y - mean);
+				if ((s >= min_samples) && ((s % ADAPTIVE_CHECK_INTERVAL) == 0)) {
+					converged = adaptive_converged(mean, m2, s, threshold_squared);
+				}
+			}
+			num_taken_samples += s - first_sample;
+			film->sums[index] = color;
+			film->counts[index] = s;
+			if (adaptive) {
+				film->means[index] = mean;
+				film->m2s[index] = m2;
+			}
+		}
+	}
+	if (out) {
+		resolve_film(film, out, cols, row_min, row_max, col_min, col_max);
+	}
+	tile_stats->ray_count = num_traced_rays;
+	tile_stats->segment_count = num_segments;
+	tile_stats->sample_count = num_taken_samples;
+}
+
+inline b8 render_tile(RenderQueue *render_queue, u32 worker_index) {
+	// NOTE(dd): checked per tile, so a tile that's already running finishes
+	// and the deadline can be overshot by about one tile
+	if ((render_queue->deadline > 0.0) && (tick() > render_queue->deadline)) {
+		return false;
+	}
+	u32 job_index = next_tile(render_queue, worker_index);
+	if (job_index == UINT32_MAX) {
+		return false;
+	}
+	RenderJob *render_job = render_queue->jobs + job_index;
+	Film tile_film = {};
+	if (render_queue->streaming) {
+		tile_film = create_tile_film(
+			render_job->row_min,
+			render_job->row_max,
+			render_job->col_min,
+			render_job->col_max,
+			render_job->settings->adaptive
+		);
+		render_job->film = &tile_film;
+	}
+	TileStats tile_stats = {};
+	PathStats *path_stats = render_queue->path_stats ? render_queue->path_stats + worker_index : NULL;
+	f64 start = render_queue->tile_records ? tick() : 0.0;
+	if (render_job->settings->mode == RENDER_MODE_WAVEFRONT) {
+		render_tile_wavefront(render_job, &tile_stats, path_stats);
+	} else {
+		render_tile_paths(render_job, &tile_stats, path_stats);
+	}
+	FloatImage *float_image = render_queue->float_image;
+	if (float_image) {
+		b8 written = write_float_tile(
+			float_image,
+			render_job->film,
+			render_job->row_min,
+			render_job->row_max,
+			render_job->col_min,
+			render_job->col_max
+		);
+		if (!written) {
+			sync_fetch_and_add(&render_queue->float_write_failures, 1);
+		}
+	}
+	if (render_queue->checkpoint) {
+		checkpoint_job(render_queue->checkpoint, render_job, render_job->film, render_queue->pass);
+	}
+	if (render_queue->streaming) {
+		TiledImage *tiled_image = render_queue->tiled_image;
+		b8 written = !tiled_image || write_tiled_image_tile(
+			tiled_image,
+			&tile_film,
+			render_job->row_min,
+			render_job->row_max,
+			render_job->col_min,
+			render_job->col_max
+		);
+		if (!written) {
+			sync_fetch_and_add(&render_queue->tiled_write_failures, 1);
+		}
+		free_film(&tile_film);
+		render_job->film = NULL;
+	}
+	u32 tile_rows = render_job->row_max - render_job->row_min;
+	u32 tile_cols = render_job->col_max - render_job->col_min;
+	tile_stats.pixel_count = tile_rows * tile_cols;
+	record_tile(render_queue, worker_index, &tile_stats);
+	if (render_queue->tile_records) {
+		f64 end = tick();
+		u64 r = sync_fetch_and_add(&render_queue->num_tile_records, 1);
+		if (r < render_queue->max_tile_records) {
+			TileRecord *record = render_queue->tile_records + r;
+			record->start = start;
+			record->end = end;
+			record->worker = worker_index;
+			record->pass = render_queue->pass;
+			record->row_min = render_job->row_min;
+			record->row_max = render_job->row_max;
+			record->col_min = render_job->col_min;
+			record->col_max = render_job->col_max;
+			record->ray_count = tile_stats.ray_count;
+			record->sample_count = tile_stats.sample_count;
+		}
+	}
+	return true;
+}
+
+inline void render_worker(void *args, u32 worker_index) {
+	RenderQueue *render_queue = (RenderQueue *) args;
+	PerfCounters *counters = render_queue->perf_counters;
+	if (counters) {
+		start_perf_counters(counters + worker_index);
+	}
+	while(render_tile(render_queue, worker_index)) {};
+	if (counters) {
+		stop_perf_counters(counters + worker_index);
+	}
+}
+
+// What a render did, for callers that want more than the printed report
+struct RenderReport {
+	u64 ray_count;
+	u64 segment_count;
+	u64 sample_count;
+	u32 num_passes;
+	u32 num_threads; // including the calling thread
+	f64 build_seconds; // bvh and friends
+	f64 seconds; // just the passes, no setup or image writing
+};
+
+// Send the image off to be written in the chosen format. A snapshot gets
+// copied since the render is still adding to it, otherwise the writer takes
+// the image and *image is left NULL.
+inline void write_render_image(ImageWriter *writer, RenderSettings *settings, Film *film, u32 **image, b8 snapshot) {
+	u32 rows = film->rows;
+	u32 cols = film->cols;
+	size_t num_pixels = (size_t) rows * cols;
+	void *pixels = NULL;
+	if (settings->image_format == IMAGE_FORMAT_HDR) {
+		f32 *linear = (f32 *) malloc(3 * sizeof(f32) * num_pixels);
+		for (size_t p = 0; p < num_pixels; p++) {
+			RGBA color = resolve_pixel(film, p);
+			linear[3 * p + 0] = color.r;
+			linear[3 * p + 1] = color.g;
+			linear[3 * p + 2] = color.b;
+		}
+		pixels = linear;
+	} else if (snapshot) {
+		pixels = malloc(sizeof(u32) * num_pixels);
+		memcpy(pixels, *image, sizeof(u32) * num_pixels);
+	} else {
+		pixels = *image;
+		*image = NULL;
+	}
+	submit_image(writer, image_path(settings->image_format), settings->image_format, rows, cols, pixels, settings->quiet);
+}
+
+inline RenderReport render(
+	World *world,
+	Camera *camera,
+	RGBA *background,
+	RenderSettings *settings,
+	RenderPool *pool
+) {
+	u32 num_threads = pool->num_threads;
+	b8 quiet = settings->quiet;
+	if (settings->image_rows) {
+		ImagePlane *image_plane = &camera->image_plane;
+		*image_plane = create_image_plane(image_plane->fov, image_plane->aspect_ratio, settings->image_rows);
+	}
+	u32 rows = camera->image_plane.rows;
+	u32 cols = camera->image_plane.cols;
+	u32 tile_rows = settings->tile_rows;
+	u32 tile_cols = settings->tile_cols;
+	b8 streaming = settings->streaming;
+	if (streaming) {
+		// tiles on disk have to line up with the TIFF tile grid
+		tile_rows = (tile_rows + TIFF_TILE_ALIGNMENT - 1) & ~(TIFF_TILE_ALIGNMENT - 1);
+		tile_cols = (tile_cols + TIFF_TILE_ALIGNMENT - 1) & ~(TIFF_TILE_ALIGNMENT - 1);
+	}
+	// scene files can come with the bvh already built
+	b8 had_bvh = world->bvh != NULL;
+	f64 sb = tick();
+	prepare_world(world);
+	f64 eb = tick();
+	if (world->bvh && !had_bvh && !quiet) {
+		printf(
+			"[info] built bvh with %d binary / %d wide nodes in %.6f seconds\n",
+			world->bvh->num_nodes,
+			world->wide_bvh->num_nodes,
+			eb - sb
+		);
+	}
+	if (settings->save_scene) {
+		f64 start = tick();
+		if (!write_scene_file(settings->save_scene, world, camera, background, settings)) {
+			printf("[warn] could not write %s\n", settings->save_scene);
+		} else if (!quiet) {
+			printf("[info] saved the scene to %s in %.6f seconds\n", settings->save_scene, tick() - start);
+		}
+	}
+	// NOTE(dd): shared by every job, so it has to outlive the pool run
+	PreparedCamera prepared_camera = prepare_camera(camera);
+	// NOTE(dd): when streaming, only the tiles being rendered have any pixels
+	// in memory
+	u32 *image = streaming ? NULL : (u32 *) calloc((size_t) rows * cols, sizeof(u32));
+	u32 *out = image;
+	Film film = streaming ? (Film) {} : create_film(rows, cols, settings->adaptive);
+	u64 pixel_count = (u64) rows * cols;
+	u32 num_tiles = ((rows + tile_rows - 1) / tile_rows)
+		* ((cols + tile_cols - 1) / tile_cols);
+	b8 progressive = settings->progressive;
+	if (streaming && progressive) {
+		printf("[warn] streaming renders every tile once, not progressively\n");
+		progressive = false;
+	}
+	b8 checkpointing = settings->checkpoint_interval > 0.0;
+	b8 resume = settings->resume;
+	if (streaming && (checkpointing || resume)) {
+		printf("[warn] streaming renders keep no film to checkpoint or resume\n");
+		checkpointing = false;
+		resume = false;
+	}
+	u32 num_samples = settings->num_samples;
+	u32 pass_samples = num_samples;
+	if (progressive) {
+		pass_samples = settings->pass_samples ? settings->pass_samples : DEFAULT_PASS_SAMPLES;
+	}
+	RenderQueue render_queue = {};
+	// leave room for every tile to be split once when stolen
+	render_queue.max_tiles = 2 * num_tiles;
+	render_queue.jobs = (RenderJob *)malloc(sizeof(RenderJob) * render_queue.max_tiles);
+	// stealing splits jobs in place, so every pass starts over from these
+	RenderJob *tile_jobs = (RenderJob *) malloc(sizeof(RenderJob) * num_tiles);
+	if (!quiet) {
+		printf("\n[start] rendering %dpx x %dpx (width x height) image with %dpx x %dpx tiles\n", cols, rows, tile_cols, tile_rows);
+	}
+	if (settings->mode == RENDER_MODE_WAVEFRONT) {
+		if (!quiet) {
+			printf("[info] using wavefront renderer\n");
+		}
+		if (settings->adaptive) {
+			printf("[warn] adaptive sampling is only done by the path renderer, taking all samples\n");
+		}
+		if (settings->light_sampling) {
+			printf("[warn] light sampling is only done by the path renderer\n");
+		}
+	} else if (!quiet) {
+		if (settings->adaptive) {
+			printf("[info] adaptive sampling down to %.4f relative error\n",
+				settings->adaptive_threshold ? settings->adaptive_threshold : DEFAULT_ADAPTIVE_THRESHOLD);
+		}
+		if (settings->light_sampling) {
+			printf("[info] sampling %d lights at diffuse hits\n", world->num_lights);
+		}
+	}
+	u32 seed = settings->seed ? settings->seed : DEFAULT_SEED;
+	if (!quiet) {
+		if (progressive) {
+			printf("[info] progressive rendering in passes of %d samples per pixel\n", pass_samples);
+		}
+		if (settings->time_budget > 0.0) {
+			printf("[info] time budget of %.3f seconds\n", settings->time_budget);
+		}
+		if (settings->deterministic) {
+			printf("[info] deterministic render with seed %u\n", seed);
+		}
+	}
+	if (settings->deterministic && (settings->time_budget > 0.0)) {
+		printf("[warn] the time budget makes the amount of work depend on timing\n");
+	}
+	u32 t = 0;
+	for (u32 i = 0; i < rows; i += tile_rows) {
+		u32 row_min = i;
+		u32 row_max = row_min + tile_rows;
+		if (row_max > rows) {
+			row_max = rows;
+		}
+		for (u32 j = 0; j < cols; j += tile_cols) {
+			u32 col_min = j;
+			u32 col_max = col_min + tile_cols;
+			if (col_max > cols) {
+				col_max = cols;
+			}
+			RenderJob *render_job = tile_jobs + t;
+			render_job->tile_index = t++;
+			render_job->background = background;
+			render_job->world = world;
+			render_job->camera = &prepared_camera;
+			render_job->rows = rows;
+			render_job->cols = cols;
+			render_job->row_min = row_min;
+			render_job->row_max = row_max;
+			render_job->col_min = col_min;
+			render_job->col_max = col_max;
+			render_job->max_depth = settings->max_depth;
+			render_job->settings = settings;
+			render_job->film = streaming ? NULL : &film;
+			render_job->out = out;
+		}
+	}
+	// the calling thread is worker 0, spawned threads take 1..num_threads
+	render_queue.num_tiles = num_tiles;
+	// split tiles wouldn't line up with the tiles on disk
+	render_queue.fixed_tiles = settings->deterministic || streaming;
+	render_queue.streaming = streaming;
+	seed_tile_deques(&render_queue, num_threads + 1);
+	if (settings->profile_tiles) {
+		u32 max_passes = (num_samples + pass_samples - 1) / pass_samples;
+		render_queue.max_tile_records = (u64) render_queue.max_tiles * max_passes;
+		render_queue.tile_records = (TileRecord *) malloc(sizeof(TileRecord) * render_queue.max_tile_records);
+	}
+	if (settings->hardware_counters) {
+		render_queue.perf_counters = create_perf_counters(num_threads + 1);
+	}
+	if (settings->path_stats) {
+		render_queue.path_stats = create_path_stats(num_threads + 1);
+	}
+	TiledImage tiled_image = {};
+	if (streaming && !settings->skip_image_write) {
+		if (open_tiled_image(&tiled_image, "image.tif", rows, cols, tile_rows, tile_cols)) {
+			render_queue.tiled_image = &tiled_image;
+		} else {
+			printf("[warn] could not create image.tif, tiles will be rendered and dropped\n");
+		}
+	}
+	FloatImage float_image = {};
+	if (settings->float_format && !settings->skip_image_write) {
+		const char *path = (settings->float_format == FLOAT_FORMAT_PFM) ? "image.pfm" : "image.exr";
+		if (open_float_image(&float_image, path, settings->float_format, rows, cols)) {
+			render_queue.float_image = &float_image;
+		} else {
+			printf("[warn] could not create %s\n", path);
+		}
+	}
+	CheckpointHeader checkpoint_header = {};
+	memcpy(checkpoint_header.magic, "YCKP", 4);
+	checkpoint_header.version = CHECKPOINT_VERSION;
+	checkpoint_header.rows = rows;
+	checkpoint_header.cols = cols;
+	checkpoint_header.tile_rows = tile_rows;
+	checkpoint_header.tile_cols = tile_cols;
+	checkpoint_header.num_tiles = num_tiles;
+	checkpoint_header.num_samples = num_samples;
+	checkpoint_header.pass_samples = pass_samples;
+	checkpoint_header.max_depth = settings->max_depth;
+	checkpoint_header.seed = seed;
+	checkpoint_header.deterministic = settings->deterministic;
+	checkpoint_header.adaptive = settings->adaptive;
+	u32 num_passes = 0;
+	u32 target_samples = 0;
+	PRNGState *resumed_prng_states = NULL;
+	u32 *resumed_passes_done = NULL;
+	if (resume) {
+		resumed_prng_states = (PRNGState *) malloc(sizeof(PRNGState) * num_tiles);
+		resumed_passes_done = (u32 *) malloc(sizeof(u32) * num_tiles);
+		if (load_checkpoint(CHECKPOINT_PATH, &checkpoint_header, &film, resumed_prng_states, resumed_passes_done)) {
+			// start at the first pass some tile hasn't finished, tiles that
+			// are further along sit out the passes they already have
+			num_passes = UINT32_MAX;
+			for (u32 k = 0; k < num_tiles; k++) {
+				if (resumed_passes_done[k] < num_passes) {
+					num_passes = resumed_passes_done[k];
+				}
+			}
+			// the loop adds a pass worth of samples before it renders
+			u64 done_samples = (u64) num_passes * pass_samples;
+			target_samples = (done_samples < num_samples) ? (u32) done_samples : num_samples;
+			resolve_film(&film, image, cols, 0, rows, 0, cols);
+			if (!quiet) {
+				printf("[info] resuming at pass %u from %s\n", num_passes + 1, CHECKPOINT_PATH);
+			}
+		} else {
+			free(resumed_prng_states);
+			free(resumed_passes_done);
+			resumed_prng_states = NULL;
+			resumed_passes_done = NULL;
+		}
+	}
+	Checkpoint *checkpoint = NULL;
+	if (checkpointing) {
+		checkpoint = create_checkpoint(&checkpoint_header, pool->writer, settings->checkpoint_interval, quiet);
+		if (resumed_passes_done) {
+			for (u32 i = 0; i < rows; i++) {
+				copy_film_row(&checkpoint->film, &film, i, 0, cols);
+			}
+			memcpy(checkpoint->prng_states, resumed_prng_states, sizeof(PRNGState) * num_tiles);
+			memcpy(checkpoint->passes_done, resumed_passes_done, sizeof(u32) * num_tiles);
+		}
+		render_queue.checkpoint = checkpoint;
+	}
+	f64 sc = tick();
+	if (settings->time_budget > 0.0) {
+		render_queue.deadline = sc + settings->time_budget;
+	}
+	while (target_samples < num_samples) {
+		target_samples += pass_samples;
+		if (target_samples > num_samples) {
+			target_samples = num_samples;
+		}
+		u32 num_queued = 0;
+		for (u32 k = 0; k < num_tiles; k++) {
+			if (resumed_passes_done && (resumed_passes_done[k] > num_passes)) {
+				continue;
+			}
+			RenderJob *render_job = render_queue.jobs + num_queued++;
+			*render_job = tile_jobs[k];
+			if (settings->deterministic) {
+				render_job->prng_state = seeded_prng_state(seed, k, num_passes);
+			} else if (resumed_prng_states) {
+				// carry on the streams the checkpoint left off with
+				render_job->prng_state = resumed_prng_states[k];
+			} else {
+				PRNGState prng_state = {read_entropy()};
+				warm_up_xor_shift(&prng_state);
+				render_job->prng_state = prng_state;
+			}
+			render_job->num_samples = target_samples;
+		}
+		free(resumed_prng_states);
+		resumed_prng_states = NULL;
+		render_queue.num_tiles = num_queued;
+		render_queue.pass = num_passes;
+		reset_tile_deques(&render_queue);
+		if (checkpoint) {
+			start_checkpoint_pass(checkpoint);
+		}
+		// memory fence here, before we modify this from threads
+		sync_fetch_and_add(&render_queue.next_split_index, 0);
+		u64 pass_start_pixels = total_stats(&render_queue).pixel_count;
+		PerfCounters *counters = render_queue.perf_counters;
+		if (counters && !start_perf_counters(counters)) {
+			// worker 0 finds out for everyone, before the pool starts
+			printf("[warn] hardware counters unavailable: %s\n", perf_counters_unavailable_reason());
+			cache_aligned_free(counters);
+			counters = NULL;
+			render_queue.perf_counters = NULL;
+		}
+		start_render_pool(pool, render_worker, (void *) &render_queue);
+		f32 progress = 0.0;
+		while (render_tile(&render_queue, 0)) {
+			if (quiet) {
+				continue;
+			}
+			progress = ((f32) (total_stats(&render_queue).pixel_count - pass_start_pixels)
+				/ (f32) pixel_count);
+			printf("[running] rendered %.2f%%...\n", progress * 100.0);
+		};
+		if (counters) {
+			stop_perf_counters(counters);
+		}
+		wait_render_pool(pool);
+		num_passes++;
+		b8 out_of_time = (render_queue.deadline > 0.0) && (tick() > render_queue.deadline);
+		if (out_of_time) {
+			printf("[warn] time budget ran out during pass %d\n", num_passes);
+			break;
+		}
+		if (progressive && (target_samples < num_samples)) {
+			if (!quiet) {
+				printf("[running] pass %d done, %d samples per pixel after %.3f seconds\n", num_passes, target_samples, tick() - sc);
+			}
+			if (!settings->skip_image_write) {
+				write_render_image(pool->writer, settings, &film, &image, true);
+			}
+		}
+	}
+	free(resumed_prng_states);
+	free(resumed_passes_done);
+	f64 ec = tick();
+	f64 dc = ec - sc;
+	u64 num_checkpoints = 0;
+	f64 checkpoint_seconds = 0.0;
+	if (checkpoint) {
+		// the last one is written from the finished film, whatever stopped
+		// the render, and takes the checkpoint with it
+		num_checkpoints = checkpoint->num_checkpoints + 1;
+		checkpoint_seconds = (f64) checkpoint->copy_nanoseconds / 1.0e9;
+		render_queue.checkpoint = NULL;
+		submit_checkpoint(checkpoint, true);
+	}
+	TileStats stats = total_stats(&render_queue);
+	RenderReport report = {};
+	report.ray_count = stats.ray_count;
+	report.segment_count = stats.segment_count;
+	report.sample_count = stats.sample_count;
+	report.num_passes = num_passes;
+	report.num_threads = num_threads + 1;
+	report.build_seconds = eb - sb;
+	report.seconds = dc;
+	f32 ray_count = (f32) stats.ray_count;
+	if (!quiet) {
+		printf("[info] processed %llu rays\n", (unsigned long long) ray_count);
+		printf(
+			"[info] took %.2f samples per pixel on average (%llu samples)\n",
+			(f64) stats.sample_count / (f64) pixel_count,
+			(unsigned long long) stats.sample_count
+		);
+		// a render cut short before its first tile has no samples to average
+		if (stats.sample_count > 0) {
+			printf(
+				"[info] average path length %.2f segments (%llu segments)\n",
+				(f64) stats.segment_count / (f64) stats.sample_count,
+				(unsigned long long) stats.segment_count
+			);
+		}
+		printf("[info] scene rendered in %.9f seconds on %d threads\n", dc, num_threads + 1);
+		printf("[info] rendered %.2f Mrays/s\n", (ray_count / 1.0e6) / dc);
+		printf("[info] ray timing: %.10f ms/ray \n", (dc * 1000.0) / ray_count);
+		if (render_queue.perf_counters) {
+			print_perf_counters(render_queue.perf_counters, num_threads + 1, stats.ray_count);
+		}
+		if (render_queue.path_stats) {
+			print_path_stats(render_queue.path_stats, num_threads + 1);
+		}
+	}
+	if (num_checkpoints && !quiet) {
+		printf(
+			"[info] %llu checkpoints, workers spent %.3f ms copying finished tiles for them\n",
+			(unsigned long long) num_checkpoints,
+			checkpoint_seconds * 1000.0
+		);
+	}
+	if (render_queue.tile_records) {
+		u64 num_records = render_queue.num_tile_records;
+		if (num_records > render_queue.max_tile_records) {
+			num_records = render_queue.max_tile_records;
+		}
+		if (!quiet) {
+			print_tile_summary(render_queue.tile_records, num_records, num_threads + 1, sc, ec);
+		}
+		if (!write_tile_trace("tiles.json", render_queue.tile_records, num_records, sc)) {
+			printf("[warn] could not write tiles.json\n");
+		}
+		if (!write_tile_heatmap("tiles_heatmap.bmp", render_queue.tile_records, num_records, rows, cols)) {
+			printf("[warn] could not write tiles_heatmap.bmp\n");
+		}
+	}
+	if (render_queue.tiled_image) {
+		if (render_queue.tiled_write_failures > 0) {
+			printf(
+				"[warn] %llu tiles could not be written to image.tif\n",
+				(unsigned long long) render_queue.tiled_write_failures
+			);
+		}
+		close_tiled_image(&tiled_image);
+	}
+	if (!settings->skip_image_write && !streaming) {
+		if (!quiet && pool->writer) {
+			printf("[info] handing %s to the writer thread\n", image_path(settings->image_format));
+		}
+		write_render_image(pool->writer, settings, &film, &image, false);
+	}
+	if (render_queue.float_image) {
+		if (render_queue.float_write_failures > 0) {
+			printf(
+				"[warn] %llu tiles could not be written to the float image\n",
+				(unsigned long long) render_queue.float_write_failures
+			);
+		}
+		close_float_image(&float_image);
+	}
+	free_render_queue(&render_queue);
+	free(tile_jobs);
+	free_film(&film);
+	free(image);
+	if (!quiet) {
+		printf("[ok] done!\n");
+	}
+	return report;
+}
+#endif // YELLOW_RENDER
@@ -0,0 +1,648 @@
+#ifndef YELLOW_SCENE_FILE
+#define YELLOW_SCENE_FILE
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "types.h"
+#include "linalg.h"
+#include "colors.h"
+#include "materials.h"
+#include "cameras.h"
+#include "bvh.h"
+#include "files.h"
+#include "threads.h"
+
+// Scenes from files, in one of two formats.
+//
+// Binary scenes are saved as the arrays the renderer works on, so loading
+// one is a matter of mapping the file and pointing the World into it. A
+// header with the camera, background and settings comes first, then the
+// materials, spheres and planes and, if the scene was saved after being
+// prepared, the binary and wide BVH, each section starting on a cache line.
+// NOTE(dd): raw little endian structs like the checkpoints, bump the version
+// whenever one of them changes. Files are trusted, nothing past the header
+// and section bounds is checked.
+//
+// Text scenes are for writing by hand (or by script), one thing per line,
+// # starts a comment:
+//
+//   camera from -2 2 1 to 0 0 -1 up 0 1 0 fov 20 aperture 0.1 aspect 1.77777778 rows 216
+//   background 0.5 0.7 1
+//   samples 100
+//   depth 50
+//   tiles 32 32
+//   threads 8
+//   material glass color 1 1 1 scatter 0 refract 1.5
+//   material lamp color 1 1 1 emit 4 4 4
+//   sphere -1 0 -1 0.5 glass
+//   plane 0 1 0 0.5 lamp
+//
+// Camera keys are all optional, focus defaults to the distance from the
+// camera to where it looks. Threads counts the calling thread too.
+// Spheres are center and radius, planes are the normal n and d for the
+// points p with n.p + d = 0, and both name a material defined on an
+// earlier line. They're parsed in a single pass straight out of the
+// mapped file.
+
+#define SCENE_FILE_VERSION 1
+#define SCENE_FILE_ALIGNMENT 64
+
+// The part of RenderSettings that belongs to a scene rather than a run
+struct SceneSettings {
+	u32 tile_rows;
+	u32 tile_cols;
+	u32 num_samples;
+	u32 max_depth;
+};
+
+struct SceneFileHeader {
+	char magic[4]; // "YSCN"
+	u32 version;
+	u32 num_materials;
+	u32 num_spheres;
+	u32 num_planes;
+	u32 num_bvh_nodes; // 0 when there's no prebuilt hierarchy
+	u32 num_wide_bvh_nodes;
+	u32 reserved;
+	Camera camera;
+	RGBA background;
+	SceneSettings settings;
+	u64 materials_offset;
+	u64 spheres_offset;
+	u64 planes_offset;
+	u64 bvh_nodes_offset;
+	u64 bvh_spheres_offset; // the hierarchy's reordered copy
+	u64 wide_bvh_nodes_offset;
+	u64 file_size;
+};
+
+// A loaded scene. The world's arrays belong to the mapping for binary
+// scenes and were allocated by the parser for text ones.
+struct SceneFile {
+	const char *path;
+	MappedFile file;
+	World world;
+	Camera camera;
+	RGBA background;
+	SceneSettings settings;
+	u32 num_threads; // from text scenes, 0 if they don't say
+	b8 mapped_bvh;
+	b8 parsed;
+	f64 load_seconds;
+};
+
+inline u64 scene_section(u64 *offset, u64 size) {
+	u64 start = (*offset + SCENE_FILE_ALIGNMENT - 1) & ~(u64) (SCENE_FILE_ALIGNMENT - 1);
+	*offset = start + size;
+	return start;
+}
+
+// Save a world, with its hierarchy if it has been prepared, false on failure
+inline b8 write_scene_file(
+	const char *path,
+	World *world,
+	Camera *camera,
+	RGBA *background,
+	RenderSettings *settings
+) {
+	SceneFileHeader header = {};
+	memcpy(header.magic, "YSCN", 4);
+	header.version = SCENE_FILE_VERSION;
+	header.num_materials = world->num_materials;
+	header.num_spheres = world->num_spheres;
+	header.num_planes = world->num_planes;
+	b8 with_bvh = world->bvh && world->wide_bvh;
+	if (with_bvh) {
+		header.num_bvh_nodes = world->bvh->num_nodes;
+		header.num_wide_bvh_nodes = world->wide_bvh->num_nodes;
+	}
+	header.camera = *camera;
+	header.background = *background;
+	header.settings.tile_rows = settings->tile_rows;
+	header.settings.tile_cols = settings->tile_cols;
+	header.settings.num_samples = settings->num_samples;
+	header.settings.max_depth = settings->max_depth;
+	u64 offset = sizeof(SceneFileHeader);
+	header.materials_offset = scene_section(&offset, sizeof(Material) * (u64) header.num_materials);
+	header.spheres_offset = scene_section(&offset, sizeof(Sphere) * (u64) header.num_spheres);
+	header.planes_offset = scene_section(&offset, sizeof(Plane) * (u64) header.num_planes);
+	if (with_bvh) {
+		header.bvh_nodes_offset = scene_section(&offset, sizeof(BVHNode) * (u64) header.num_bvh_nodes);
+		header.bvh_spheres_offset = scene_section(&offset, sizeof(Sphere) * (u64) header.num_spheres);
+		header.wide_bvh_nodes_offset = scene_section(&offset, sizeof(WideBVHNode) * (u64) header.num_wide_bvh_nodes);
+	}
+	header.file_size = offset;
+	FileHandle file = create_file(path);
+	if (file == INVALID_FILE) {
+		return false;
+	}
+	b8 ok = resize_file(file, header.file_size);
+	ok = ok && write_at(file, 0, &header, sizeof(header));
+	ok = ok && write_at(file, header.materials_offset, world->materials, sizeof(Material) * (u64) header.num_materials);
+	ok = ok && write_at(file, header.spheres_offset, world->spheres, sizeof(Sphere) * (u64) header.num_spheres);
+	ok = ok && write_at(file, header.planes_offset, world->planes, sizeof(Plane) * (u64) header.num_planes);
+	if (with_bvh) {
+		ok = ok && write_at(file, header.bvh_nodes_offset, world->bvh->nodes, sizeof(BVHNode) * (u64) header.num_bvh_nodes);
+		ok = ok && write_at(file, header.bvh_spheres_offset, world->bvh->spheres, sizeof(Sphere) * (u64) header.num_spheres);
+		ok = ok && write_at(
+			file,
+			header.wide_bvh_nodes_offset,
+			world->wide_bvh->nodes,
+			sizeof(WideBVHNode) * (u64) header.num_wide_bvh_nodes
+		);
+	}
+	close_file(file);
+	return ok;
+}
+
+inline b8 scene_section_fits(SceneFileHeader *header, u64 offset, u64 size) {
+	return (offset % SCENE_FILE_ALIGNMENT == 0) && (offset <= header->file_size) && (size <= header->file_size - offset);
+}
+
+// Point the world at a mapped binary scene. Only the BVH and WideBVH
+// structs are allocated, the rest is read straight from the page cache.
+inline b8 read_binary_scene(SceneFile *scene, const char *path) {
+	SceneFileHeader *header = (SceneFileHeader *) scene->file.data;
+	b8 ok = scene->file.size >= sizeof(SceneFileHeader);
+	ok = ok && (header->version == SCENE_FILE_VERSION);
+	if (!ok) {
+		printf("[warn] %s is not a scene this build can read\n", path);
+		return false;
+	}
+	ok = header->file_size == scene->file.size;
+	ok = ok && scene_section_fits(header, header->materials_offset, sizeof(Material) * (u64) header->num_materials);
+	ok = ok && scene_section_fits(header, header->spheres_offset, sizeof(Sphere) * (u64) header->num_spheres);
+	ok = ok && scene_section_fits(header, header->planes_offset, sizeof(Plane) * (u64) header->num_planes);
+	if (header->num_bvh_nodes) {
+		ok = ok && scene_section_fits(header, header->bvh_nodes_offset, sizeof(BVHNode) * (u64) header->num_bvh_nodes);
+		ok = ok && scene_section_fits(header, header->bvh_spheres_offset, sizeof(Sphere) * (u64) header->num_spheres);
+		ok = ok && scene_section_fits(
+			header,
+			header->wide_bvh_nodes_offset,
+			sizeof(WideBVHNode) * (u64) header->num_wide_bvh_nodes
+		);
+		ok = ok && (header->num_wide_bvh_nodes > 0);
+	}
+	if (!ok) {
+		printf("[warn] scene %s is cut short or damaged\n", path);
+		return false;
+	}
+	u8 *data = scene->file.data;
+	World *world = &scene->world;
+	world->num_materials = header->num_materials;
+	world->num_spheres = header->num_spheres;
+	world->num_planes = header->num_planes;
+	world->materials = (Material *) (data + header->materials_offset);
+	world->spheres = (Sphere *) (data + header->spheres_offset);
+	world->planes = (Plane *) (data + header->planes_offset);
+	if (header->num_bvh_nodes) {
+		BVH *bvh = (BVH *) malloc(sizeof(BVH));
+		bvh->num_nodes = header->num_bvh_nodes;
+		bvh->num_spheres = header->num_spheres;
+		bvh->nodes = (BVHNode *) (data + header->bvh_nodes_offset);
+		bvh->spheres = (Sphere *) (data + header->bvh_spheres_offset);
+		WideBVH *wide = (WideBVH *) malloc(sizeof(WideBVH));
+		wide->num_nodes = header->num_wide_bvh_nodes;
+		wide->num_spheres = header->num_spheres;
+		wide->nodes = (WideBVHNode *) (data + header->wide_bvh_nodes_offset);
+		wide->spheres = bvh->spheres;
+		world->bvh = bvh;
+		world->wide_bvh = wide;
+		scene->mapped_bvh = true;
+	}
+	scene->camera = header->camera;
+	scene->background = header->background;
+	scene->settings = header->settings;
+	return true;
+}
+
+// Where the parser is in a text scene, and what it has seen so far
+struct SceneParser {
+	const char *path;
+	const char *at;
+	const char *end;
+	u32 line;
+	b8 failed;
+	u32 material_capacity;
+	u32 sphere_capacity;
+	u32 plane_capacity;
+	// material names point into the text and are looked up through an open
+	// addressing table of material index + 1, 0 for empty slots
+	const char **material_names;
+	u32 *material_name_lengths;
+	u32 *material_table;
+	u32 material_table_size; // power of two
+	// camera keys, turned into a Camera once everything is read
+	Point3D from;
+	Point3D to;
+	Vec3D up;
+	f32 fov;
+	f32 aperture;
+	f32 focus; // 0 means the distance from from to to
+	f32 aspect_ratio;
+	u32 rows;
+};
+
+inline void scene_error(SceneParser *parser, const char *message, const char *word, u32 length) {
+	if (!parser->failed) {
+		printf("[warn] %s:%u: %s %.*s\n", parser->path, parser->line, message, (i32) length, word ? word : "");
+	}
+	parser->failed = true;
+}
+
+// Next word on the current line, NULL at the end of it or at a comment
+inline const char *next_scene_word(SceneParser *parser, u32 *length) {
+	const char *at = parser->at;
+	const char *end = parser->end;
+	while ((at < end) && ((*at == ' ') || (*at == '\t') || (*at == '\r'))) {
+		at++;
+	}
+	const char *word = at;
+	while ((at < end) && (*at != ' ') && (*at != '\t') && (*at != '\r') && (*at != '\n') && (*at != '#')) {
+		at++;
+	}
+	parser->at = at;
+	*length = (u32) (at - word);
+	return (*length > 0) ? word : NULL;
+}
+
+inline b8 scene_word_is(const char *word, u32 length, const char *expected) {
+	return (strlen(expected) == length) && (memcmp(word, expected, length) == 0);
+}
+
+// Complain about anything but a comment left on the line, then go to the next
+inline void end_scene_line(SceneParser *parser) {
+	u32 length = 0;
+	const char *word = next_scene_word(parser, &length);
+	if (word) {
+		scene_error(parser, "unexpected", word, length);
+		return;
+	}
+	const char *newline = (const char *) memchr(parser->at, '\n', parser->end - parser->at);
+	parser->at = newline ? newline + 1 : parser->end;
+	parser->line++;
+}
+
+// NOTE(dd): strtof goes through the locale and is a lot slower than this,
+// which only handles plain decimals with an optional exponent. It's exact
+// up to float rounding for anything a scene would reasonably have in it.
+inline b8 parse_scene_f32(SceneParser *parser, f32 *value) {
+	static const f64 powers_of_ten[23] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	u32 length = 0;
+	const char *word = next_scene_word(parser, &length);
+	if (word == NULL) {
+		scene_error(parser, "expected a number", NULL, 0);
+		return false;
+	}
+	const char *at = word;
+	const char *end = word + length;
+	b8 negative = *at == '-';
+	if ((*at == '-') || (*at == '+')) {
+		at++;
+	}
+	u64 mantissa = 0;
+	i32 exponent = 0;
+	u32 num_digits = 0;
+	for (; (at < end) && (*at >= '0') && (*at <= '9'); at++, num_digits++) {
+		if (mantissa < 100000000000000000ull) {
+			mantissa = 10 * mantissa + (*at - '0');
+		} else {
+			exponent++;
+		}
+	}
+	if ((at < end) && (*at == '.')) {
+		for (at++; (at < end) && (*at >= '0') && (*at <= '9'); at++, num_digits++) {
+			if (mantissa < 100000000000000000ull) {
+				mantissa = 10 * mantissa + (*at - '0');
+				exponent--;
+			}
+		}
+	}
+	b8 ok = num_digits > 0;
+	if (ok && (at < end) && ((*at == 'e') || (*at == 'E'))) {
+		at++;
+		i32 sign = (at < end) && (*at == '-') ? -1 : 1;
+		if ((at < end) && ((*at == '-') || (*at == '+'))) {
+			at++;
+		}
+		i32 power = 0;
+		ok = (at < end);
+		for (; (at < end) && (*at >= '0') && (*at <= '9'); at++) {
+			power = (power < 1000) ? 10 * power + (*at - '0') : power;
+		}
+		exponent += sign * power;
+	}
+	if (!ok || (at != end)) {
+		scene_error(parser, "expected a number, not", word, length);
+		return false;
+	}
+	f64 result = (f64) mantissa;
+	if ((exponent >= 0) && (exponent <= 22)) {
+		result *= powers_of_ten[exponent];
+	} else if ((exponent < 0) && (exponent >= -22)) {
+		result /= powers_of_ten[-exponent];
+	} else {
+		result *= pow(10.0, (f64) exponent);
+	}
+	*value = (f32) (negative ? -result : result);
+	return true;
+}
+
+inline b8 parse_scene_u32(SceneParser *parser, u32 *value) {
+	u32 length = 0;
+	const char *word = next_scene_word(parser, &length);
+	if (word == NULL) {
+		scene_error(parser, "expected a whole number", NULL, 0);
+		return false;
+	}
+	u64 result = 0;
+	for (u32 i = 0; i < length; i++) {
+		if ((word[i] < '0') || (word[i] > '9') || (result > UINT32_MAX)) {
+			scene_error(parser, "expected a whole number, not", word, length);
+			return false;
+		}
+		result = 10 * result + (word[i] - '0');
+	}
+	if (result > UINT32_MAX) {
+		scene_error(parser, "number out of range", word, length);
+		return false;
+	}
+	*value = (u32) result;
+	return true;
+}
+
+inline b8 parse_scene_vec(SceneParser *parser, Vec3D *vec) {
+	return parse_scene_f32(parser, &vec->x) && parse_scene_f32(parser, &vec->y) && parse_scene_f32(parser, &vec->z);
+}
+
+inline b8 parse_scene_color(SceneParser *parser, RGBA *color) {
+	*color = (RGBA) {0.0, 0.0, 0.0, 1.0};
+	return parse_scene_f32(parser, &color->r) && parse_scene_f32(parser, &color->g) && parse_scene_f32(parser, &color->b);
+}
+
+// Make room for one more element, doubling as needed
+inline void *grow_scene_array(void *array, u32 *capacity, u32 count, size_t size) {
+	if (count < *capacity) {
+		return array;
+	}
+	*capacity = *capacity ? 2 * *capacity : 64;
+	return realloc(array, *capacity * size);
+}
+
+inline u32 hash_scene_name(const char *name, u32 length) {
+	// FNV-1a
+	u32 hash = 2166136261u;
+	for (u32 i = 0; i < length; i++) {
+		hash = (hash ^ (u8) name[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// The table slot that has the name, or the empty one it would go in
+inline u32 *scene_material_slot(SceneParser *parser, const char *name, u32 length) {
+	u32 mask = parser->material_table_size - 1;
+	u32 slot = hash_scene_name(name, length) & mask;
+	while (parser->material_table[slot]) {
+		u32 m = parser->material_table[slot] - 1;
+		if ((parser->material_name_lengths[m] == length) && (memcmp(parser->material_names[m], name, length) == 0)) {
+			break;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return parser->material_table + slot;
+}
+
+// material <name> [color r g b] [scatter s] [refract n] [emit r g b]
+inline void parse_scene_material(SceneParser *parser, World *world) {
+	u32 length = 0;
+	const char *name = next_scene_word(parser, &length);
+	if (name == NULL) {
+		scene_error(parser, "material needs a name", NULL, 0);
+		return;
+	}
+	u32 index = world->num_materials;
+	// keep the table at most half full
+	if (2 * (index + 1) > parser->material_table_size) {
+		free(parser->material_table);
+		parser->material_table_size = parser->material_table_size ? 2 * parser->material_table_size : 64;
+		parser->material_table = (u32 *) calloc(parser->material_table_size, sizeof(u32));
+		for (u32 m = 0; m < index; m++) {
+			*scene_material_slot(parser, parser->material_names[m], parser->material_name_lengths[m]) = m + 1;
+		}
+	}
+	u32 *slot = scene_material_slot(parser, name, length);
+	if (*slot) {
+		scene_error(parser, "there already is a material called", name, length);
+		return;
+	}
+	*slot = index + 1;
+	if (index == parser->material_capacity) {
+		u32 capacity = index ? 2 * index : 64;
+		parser->material_capacity = capacity;
+		world->materials = (Material *) realloc(world->materials, capacity * sizeof(Material));
+		parser->material_names = (const char **) realloc(parser->material_names, capacity * sizeof(const char *));
+		parser->material_name_lengths = (u32 *) realloc(parser->material_name_lengths, capacity * sizeof(u32));
+	}
+	parser->material_names[index] = name;
+	parser->material_name_lengths[index] = length;
+	Material *material = world->materials + index;
+	*material = {};
+	material->color = (RGBA) {0.5, 0.5, 0.5, 1.0};
+	material->scatter_index = 1.0;
+	world->num_materials++;
+	const char *key = NULL;
+	while (!parser->failed && (key = next_scene_word(parser, &length))) {
+		if (scene_word_is(key, length, "color")) {
+			parse_scene_color(parser, &material->color);
+		} else if (scene_word_is(key, length, "emit")) {
+			parse_scene_color(parser, &material->emit);
+		} else if (scene_word_is(key, length, "scatter")) {
+			parse_scene_f32(parser, &material->scatter_index);
+		} else if (scene_word_is(key, length, "refract")) {
+			parse_scene_f32(parser, &material->refractive_index);
+		} else {
+			scene_error(parser, "unknown material key", key, length);
+		}
+	}
+}
+
+inline b8 parse_scene_material_name(SceneParser *parser, u32 *material_index) {
+	u32 length = 0;
+	const char *name = next_scene_word(parser, &length);
+	if (name == NULL) {
+		scene_error(parser, "expected a material", NULL, 0);
+		return false;
+	}
+	u32 slot = parser->material_table_size ? *scene_material_slot(parser, name, length) : 0;
+	if (slot == 0) {
+		scene_error(parser, "no material called", name, length);
+		return false;
+	}
+	*material_index = slot - 1;
+	return true;
+}
+
+// camera [from x y z] [to x y z] [up x y z] [fov f] [aperture a] [focus d]
+// [aspect ratio] [rows n]
+inline void parse_scene_camera(SceneParser *parser) {
+	u32 length = 0;
+	const char *key = NULL;
+	while (!parser->failed && (key = next_scene_word(parser, &length))) {
+		if (scene_word_is(key, length, "from")) {
+			parse_scene_vec(parser, &parser->from);
+		} else if (scene_word_is(key, length, "to")) {
+			parse_scene_vec(parser, &parser->to);
+		} else if (scene_word_is(key, length, "up")) {
+			parse_scene_vec(parser, &parser->up);
+		} else if (scene_word_is(key, length, "fov")) {
+			parse_scene_f32(parser, &parser->fov);
+		} else if (scene_word_is(key, length, "aperture")) {
+			parse_scene_f32(parser, &parser->aperture);
+		} else if (scene_word_is(key, length, "focus")) {
+			parse_scene_f32(parser, &parser->focus);
+		} else if (scene_word_is(key, length, "aspect")) {
+			parse_scene_f32(parser, &parser->aspect_ratio);
+		} else if (scene_word_is(key, length, "rows")) {
+			parse_scene_u32(parser, &parser->rows);
+		} else {
+			scene_error(parser, "unknown camera key", key, length);
+		}
+	}
+}
+
+// Parse a mapped text scene into arrays of our own
+inline b8 parse_scene_text(SceneFile *scene, const char *path) {
+	SceneParser parser = {};
+	parser.path = path;
+	parser.at = (const char *) scene->file.data;
+	parser.end = parser.at + scene->file.size;
+	parser.line = 1;
+	parser.from = (Point3D) {0.0, 0.0, 0.0};
+	parser.to = (Point3D) {0.0, 0.0, -1.0};
+	parser.up = (Vec3D) {0.0, 1.0, 0.0};
+	parser.fov = 20.0;
+	parser.aspect_ratio = 16.0 / 9.0;
+	parser.rows = 216;
+	World *world = &scene->world;
+	scene->background = (RGBA) {0.5, 0.7, 1.0, 1.0};
+	scene->settings = (SceneSettings) {32, 32, 100, 50};
+	while (!parser.failed && (parser.at < parser.end)) {
+		u32 length = 0;
+		const char *word = next_scene_word(&parser, &length);
+		if (word == NULL) {
+			// blank or just a comment
+		} else if (scene_word_is(word, length, "sphere")) {
+			world->spheres = (Sphere *) grow_scene_array(world->spheres, &parser.sphere_capacity, world->num_spheres, sizeof(Sphere));
+			Sphere *sphere = world->spheres + world->num_spheres;
+			b8 ok = parse_scene_vec(&parser, &sphere->origin);
+			ok = ok && parse_scene_f32(&parser, &sphere->radius);
+			ok = ok && parse_scene_material_name(&parser, &sphere->material_index);
+			world->num_spheres += ok;
+		} else if (scene_word_is(word, length, "plane")) {
+			world->planes = (Plane *) grow_scene_array(world->planes, &parser.plane_capacity, world->num_planes, sizeof(Plane));
+			Plane *plane = world->planes + world->num_planes;
+			b8 ok = parse_scene_vec(&parser, &plane->normal);
+			ok = ok && parse_scene_f32(&parser, &plane->distance);
+			ok = ok && parse_scene_material_name(&parser, &plane->material_index);
+			if (ok) {
+				plane->normal = normalize(&plane->normal);
+			}
+			world->num_planes += ok;
+		} else if (scene_word_is(word, length, "material")) {
+			parse_scene_material(&parser, world);
+		} else if (scene_word_is(word, length, "camera")) {
+			parse_scene_camera(&parser);
+		} else if (scene_word_is(word, length, "background")) {
+			parse_scene_color(&parser, &scene->background);
+		} else if (scene_word_is(word, length, "samples")) {
+			parse_scene_u32(&parser, &scene->settings.num_samples);
+		} else if (scene_word_is(word, length, "depth")) {
+			parse_scene_u32(&parser, &scene->settings.max_depth);
+		} else if (scene_word_is(word, length, "tiles")) {
+			// one number for square tiles
+			if (parse_scene_u32(&parser, &scene->settings.tile_rows)) {
+				scene->settings.tile_cols = scene->settings.tile_rows;
+				const char *at = parser.at;
+				if (next_scene_word(&parser, &length)) {
+					parser.at = at;
+					parse_scene_u32(&parser, &scene->settings.tile_cols);
+				}
+			}
+		} else if (scene_word_is(word, length, "threads")) {
+			parse_scene_u32(&parser, &scene->num_threads);
+		} else {
+			scene_error(&parser, "don't know what this is:", word, length);
+		}
+		if (!parser.failed) {
+			end_scene_line(&parser);
+		}
+	}
+	Vec3D normal = parser.from - parser.to;
+	f32 distance = l2_norm(&normal);
+	if (!parser.failed && (distance == 0.0)) {
+		scene_error(&parser, "the camera has to look somewhere other than where it is", NULL, 0);
+	}
+	if (!parser.failed && ((scene->settings.tile_rows == 0) || (scene->settings.tile_cols == 0) || (parser.rows == 0))) {
+		scene_error(&parser, "tiles and rows can't be 0", NULL, 0);
+	}
+	free(parser.material_names);
+	free(parser.material_name_lengths);
+	free(parser.material_table);
+	if (parser.failed) {
+		free(world->materials);
+		free(world->spheres);
+		free(world->planes);
+		*world = {};
+		return false;
+	}
+	normal = normal / distance;
+	f32 focal_distance = (parser.focus > 0.0) ? parser.focus : distance;
+	ImagePlane image_plane = create_image_plane(parser.fov, parser.aspect_ratio, parser.rows);
+	scene->camera = (Camera) {parser.from, normal, parser.up, image_plane, parser.aperture, focal_distance};
+	scene->parsed = true;
+	return true;
+}
+
+// Load a binary or text scene, whichever the file turns out to be
+inline b8 open_scene_file(SceneFile *scene, const char *path) {
+	*scene = {};
+	scene->path = path;
+	f64 start = tick();
+	if (!map_file(&scene->file, path)) {
+		printf("[warn] could not open scene %s\n", path);
+		return false;
+	}
+	b8 binary = (scene->file.size >= 4) && (memcmp(scene->file.data, "YSCN", 4) == 0);
+	b8 ok = binary ? read_binary_scene(scene, path) : parse_scene_text(scene, path);
+	if (!binary || !ok) {
+		// nothing points into the file any more
+		unmap_file(&scene->file);
+	}
+	scene->load_seconds = tick() - start;
+	return ok;
+}
+
+inline void close_scene_file(SceneFile *scene) {
+	World *world = &scene->world;
+	if (scene->mapped_bvh) {
+		// the nodes and spheres are in the mapping, only the structs are ours
+		free(world->wide_bvh);
+		free(world->bvh);
+		world->wide_bvh = NULL;
+		world->bvh = NULL;
+	}
+	release_world(world);
+	if (scene->parsed) {
+		free(world->materials);
+		free(world->spheres);
+		free(world->planes);
+	}
+	if (scene->file.data) {
+		unmap_file(&scene->file);
+	}
+}
+#endif //YELLOW_SCENE_FILE
@@ -0,0 +1,162 @@
+#ifndef YELLOW_STATS
+#define YELLOW_STATS
+#include <cstdio>
+#include <cstring>
+#include "types.h"
+#include "threads.h"
+
+// Where paths end and what they do on the way, to tell which scenes would
+// gain from roulette, light sampling or batched shading and what a max_depth
+// change would cost. Each worker has its own PathStats, summed at the end.
+
+// Paths this long or longer share the last bin of the histogram
+#define PATH_STATS_MAX_SEGMENTS 64
+
+enum PathEnd {
+	PATH_END_ESCAPED, // flew off into the background
+	PATH_END_MAX_DEPTH, // still bouncing when max_depth ran out
+	PATH_END_ROULETTE,
+	NUM_PATH_ENDS
+};
+
+enum PathEvent {
+	PATH_EVENT_DIFFUSE,
+	PATH_EVENT_MIRROR,
+	PATH_EVENT_FUZZY,
+	PATH_EVENT_REFRACT,
+	PATH_EVENT_TOTAL_INTERNAL_REFLECTION,
+	PATH_EVENT_SCHLICK_REFLECTION,
+	NUM_PATH_EVENTS
+};
+
+static const char *path_end_names[NUM_PATH_ENDS] = {
+	"escaped",
+	"hit max depth",
+	"ended by roulette",
+};
+
+static const char *path_event_names[NUM_PATH_EVENTS] = {
+	"diffuse",
+	"mirror",
+	"fuzzy",
+	"refract",
+	"total internal reflection",
+	"schlick reflection",
+};
+
+struct alignas(CACHE_LINE_SIZE) PathStats {
+	u64 segments[PATH_STATS_MAX_SEGMENTS + 1]; // paths by segments traced, 1 based
+	u64 ends[NUM_PATH_ENDS];
+	u64 events[NUM_PATH_EVENTS];
+	u64 unit_sphere_samples; // calls to random_unit_sphere_vector, random_unit_vector's too
+	u64 unit_sphere_draws; // candidates drawn by its rejection loop
+};
+
+// All of these take NULL for "not counting", which is what the renderers
+// pass unless settings->path_stats is on
+inline void count_path_end(PathStats *stats, PathEnd end, u32 num_segments) {
+	if (stats) {
+		stats->ends[end]++;
+		stats->segments[(num_segments < PATH_STATS_MAX_SEGMENTS) ? num_segments : PATH_STATS_MAX_SEGMENTS]++;
+	}
+}
+
+inline void count_path_event(PathStats *stats, PathEvent event) {
+	if (stats) {
+		stats->events[event]++;
+	}
+}
+
+inline void count_unit_sphere_draws(PathStats *stats, u32 num_draws) {
+	if (stats) {
+		stats->unit_sphere_samples++;
+		stats->unit_sphere_draws += num_draws;
+	}
+}
+
+inline PathStats *create_path_stats(u32 num_workers) {
+	PathStats *stats = (PathStats *) cache_aligned_malloc(sizeof(PathStats) * num_workers);
+	memset(stats, 0, sizeof(PathStats) * num_workers);
+	return stats;
+}
+
+inline PathStats total_path_stats(PathStats *stats, u32 num_workers) {
+	PathStats total = {};
+	for (u32 w = 0; w < num_workers; w++) {
+		for (u32 b = 0; b <= PATH_STATS_MAX_SEGMENTS; b++) {
+			total.segments[b] += stats[w].segments[b];
+		}
+		for (u32 e = 0; e < NUM_PATH_ENDS; e++) {
+			total.ends[e] += stats[w].ends[e];
+		}
+		for (u32 e = 0; e < NUM_PATH_EVENTS; e++) {
+			total.events[e] += stats[w].events[e];
+		}
+		total.unit_sphere_samples += stats[w].unit_sphere_samples;
+		total.unit_sphere_draws += stats[w].unit_sphere_draws;
+	}
+	return total;
+}
+
+inline void print_path_stats(PathStats *stats, u32 num_workers) {
+	PathStats total = total_path_stats(stats, num_workers);
+	u64 num_paths = 0;
+	for (u32 e = 0; e < NUM_PATH_ENDS; e++) {
+		num_paths += total.ends[e];
+	}
+	if (num_paths == 0) {
+		return;
+	}
+	for (u32 e = 0; e < NUM_PATH_ENDS; e++) {
+		printf(
+			"[info] %6.2f%% of paths %s (%llu)\n",
+			100.0 * (f64) total.ends[e] / (f64) num_paths,
+			path_end_names[e],
+			(unsigned long long) total.ends[e]
+		);
+	}
+	// the long thin tail past 99.9% of paths goes in one last row
+	u64 most = 0;
+	u64 running = 0;
+	u32 last_bin = PATH_STATS_MAX_SEGMENTS;
+	for (u32 b = 1; b <= PATH_STATS_MAX_SEGMENTS; b++) {
+		if (total.segments[b] > most) {
+			most = total.segments[b];
+		}
+		running += total.segments[b];
+		if ((running >= num_paths - num_paths / 1000) && (b < last_bin)) {
+			last_bin = b + 1;
+		}
+	}
+	u64 tail = num_paths;
+	printf("[info] path length histogram (segments):\n");
+	for (u32 b = 1; b <= last_bin; b++) {
+		u64 count = (b == last_bin) ? tail : total.segments[b];
+		tail -= total.segments[b];
+		char bar[41] = {};
+		u32 width = (u32) (40.0 * (f64) count / (f64) most);
+		memset(bar, '#', (width < 40) ? width : 40);
+		printf(
+			"[info] %3u%s %6.2f%% %s\n",
+			b,
+			(b == last_bin) ? "+" : " ",
+			100.0 * (f64) count / (f64) num_paths,
+			bar
+		);
+	}
+	for (u32 e = 0; e < NUM_PATH_EVENTS; e++) {
+		printf(
+			"[info] %.3f %s events per path (%llu)\n",
+			(f64) total.events[e] / (f64) num_paths,
+			path_event_names[e],
+			(unsigned long long) total.events[e]
+		);
+	}
+	if (total.unit_sphere_samples > 0) {
+		printf(
+			"[info] unit sphere rejection sampling drew %.3f candidates per sample\n",
+			(f64) total.unit_sphere_draws / (f64) total.unit_sphere_samples
+		);
+	}
+}
+#endif //YELLOW_STATS
@@ -1,8 +1,16 @@
 #ifndef YELLOW_THREADS
 #define YELLOW_THREADS
+#include <cstdlib>
 #include "types.h"
 #include "materials.h"
 #include "cameras.h"
+#include "rand.h"
+#include "film.h"
+#include "hdr.h"
+#include "tiled.h"
+
+// per-thread data is padded out to this so workers never share a line
+#define CACHE_LINE_SIZE 64
 
 #ifdef _WIN32 // WINDOWS
 #include <windows.h>
@@ -32,6 +40,63 @@ inline u64 sync_fetch_and_add(volatile u64 *x, u64 by) {
 	return InterlockedExchangeAdd64((volatile i64 *) x, by);
 }
 
+// Set x to desired if it still holds expected, true if it did
+inline b8 sync_compare_and_swap(volatile u64 *x, u64 expected, u64 desired) {
+	return InterlockedCompareExchange64((volatile i64 *) x, desired, expected) == (i64) expected;
+}
+
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE Condition;
+
+inline void init_mutex(Mutex *mutex) {
+	InitializeSRWLock(mutex);
+}
+
+inline void lock_mutex(Mutex *mutex) {
+	AcquireSRWLockExclusive(mutex);
+}
+
+inline void unlock_mutex(Mutex *mutex) {
+	ReleaseSRWLockExclusive(mutex);
+}
+
+inline void destroy_mutex(Mutex *mutex) {}
+
+inline void init_condition(Condition *condition) {
+	InitializeConditionVariable(condition);
+}
+
+// Atomically release the mutex and sleep until woken, then re-lock it
+inline void wait_condition(Condition *condition, Mutex *mutex) {
+	SleepConditionVariableSRW(condition, mutex, INFINITE, 0);
+}
+
+inline void wake_all(Condition *condition) {
+	WakeAllConditionVariable(condition);
+}
+
+inline void destroy_condition(Condition *condition) {}
+
+inline void spin_lock(volatile u32 *lock) {
+	while (InterlockedExchange((volatile LONG *) lock, 1)) {
+		while (*lock) {
+			YieldProcessor();
+		}
+	}
+}
+
+inline void spin_unlock(volatile u32 *lock) {
+	InterlockedExchange((volatile LONG *) lock, 0);
+}
+
+inline void *cache_aligned_malloc(size_t size) {
+	return _aligned_malloc(size, CACHE_LINE_SIZE);
+}
+
+inline void cache_aligned_free(void *memory) {
+	_aligned_free(memory);
+}
+
 inline f64 tick() {
 	LARGE_INTEGER current_ticks;
 	LARGE_INTEGER tick_frequency;
@@ -76,6 +141,69 @@ inline u64 sync_fetch_and_add(volatile u64 *x, u64 by) {
 	return __sync_fetch_and_add(x, by);
 }
 
+// Set x to desired if it still holds expected, true if it did
+inline b8 sync_compare_and_swap(volatile u64 *x, u64 expected, u64 desired) {
+	return __sync_bool_compare_and_swap(x, expected, desired);
+}
+
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+
+inline void init_mutex(Mutex *mutex) {
+	pthread_mutex_init(mutex, NULL);
+}
+
+inline void lock_mutex(Mutex *mutex) {
+	pthread_mutex_lock(mutex);
+}
+
+inline void unlock_mutex(Mutex *mutex) {
+	pthread_mutex_unlock(mutex);
+}
+
+inline void destroy_mutex(Mutex *mutex) {
+	pthread_mutex_destroy(mutex);
+}
+
+inline void init_condition(Condition *condition) {
+	pthread_cond_init(condition, NULL);
+}
+
+// Atomically release the mutex and sleep until woken, then re-lock it
+inline void wait_condition(Condition *condition, Mutex *mutex) {
+	pthread_cond_wait(condition, mutex);
+}
+
+inline void wake_all(Condition *condition) {
+	pthread_cond_broadcast(condition);
+}
+
+inline void destroy_condition(Condition *condition) {
+	pthread_cond_destroy(condition);
+}
+
+inline void spin_lock(volatile u32 *lock) {
+	while (__sync_lock_test_and_set(lock, 1)) {
+		while (*lock) {}
+	}
+}
+
+inline void spin_unlock(volatile u32 *lock) {
+	__sync_lock_release(lock);
+}
+
+inline void *cache_aligned_malloc(size_t size) {
+	void *memory = NULL;
+	if (posix_memalign(&memory, CACHE_LINE_SIZE, size) != 0) {
+		return NULL;
+	}
+	return memory;
+}
+
+inline void cache_aligned_free(void *memory) {
+	free(memory);
+}
+
 inline f64 tick() {
 	struct timespec ts;
 	i32 res = clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -87,27 +215,566 @@ inline f64 tick() {
 }
 #endif //_WIN32
 
+enum RenderMode {
+	RENDER_MODE_PATH, // one path at a time, depth first
+	RENDER_MODE_WAVEFRONT, // batches of paths, one bounce at a time
+};
+
+enum ImageFormat {
+	IMAGE_FORMAT_BMP, // image.bmp
+	IMAGE_FORMAT_PNG, // image.png
+	IMAGE_FORMAT_HDR, // image.hdr, Radiance RGBE from the linear film
+};
+
+#define ADAPTIVE_CHECK_INTERVAL 8
+#define DEFAULT_ADAPTIVE_THRESHOLD 0.02
+#define DEFAULT_MIN_SAMPLES 32
+#define DEFAULT_ROULETTE_DEPTH 3
+#define DEFAULT_PASS_SAMPLES 8
+#define DEFAULT_SEED 0x5eed
+
+// Everything about how to render, as opposed to what. Zero means default.
+struct RenderSettings {
+	u32 tile_rows;
+	u32 tile_cols;
+	u32 num_samples;
+	u32 max_depth;
+	RenderMode mode;
+	// stop sampling a pixel once the standard error of its mean luminance
+	// drops below adaptive_threshold times the mean, checked every
+	// ADAPTIVE_CHECK_INTERVAL samples between min_samples and num_samples
+	b8 adaptive;
+	f32 adaptive_threshold;
+	u32 min_samples;
+	// next event estimation toward emissive spheres, combined with the
+	// diffuse bounce by multiple importance sampling
+	b8 light_sampling;
+	// past roulette_depth bounces, end paths at random with a survival
+	// probability that follows their throughput
+	b8 russian_roulette;
+	u32 roulette_depth;
+	// take the samples in passes of pass_samples over the whole image and
+	// write a snapshot after each one
+	b8 progressive;
+	u32 pass_samples;
+	// stop handing out tiles this many seconds after rendering starts, the
+	// image keeps whatever samples each pixel had by then
+	f32 time_budget;
+	// seed every tile from (seed, tile, pass) instead of the OS and never
+	// split tiles, so the image and ray count don't depend on thread count
+	// or timing. The time budget still cuts renders short when it's set.
+	b8 deterministic;
+	u32 seed;
+	// image height in pixels, replacing the scene's, width follows its aspect ratio
+	u32 image_rows;
+	// only warnings get printed, for benchmarks and other tools
+	b8 quiet;
+	b8 skip_image_write;
+	// time every tile and write tiles.json (chrome://tracing) and
+	// tiles_heatmap.bmp (seconds per pixel) next to the image
+	b8 profile_tiles;
+	// read cycles, instructions, cache and branch misses on every worker
+	// (Linux only) and print them per ray
+	b8 hardware_counters;
+	// count how paths end, how long they get and what they bounce off
+	b8 path_stats;
+	// also write linear float image.pfm or image.exr, tile by tile as they
+	// finish
+	FloatFormat float_format;
+	// for images too big for memory: one pass, every tile gets its own film
+	// and goes to image.tif as soon as it's done, instead of image.bmp
+	b8 streaming;
+	ImageFormat image_format;
+	// save the film to render.checkpoint as tiles finish, at most this
+	// often and always when the render stops, and/or start from the saved one
+	f32 checkpoint_interval;
+	b8 resume;
+	// write the prepared world, bvh included, and the camera and settings to
+	// this scene file before rendering, see scenefile.h
+	const char *save_scene;
+};
+
+// Take every nonzero field of overrides, so callers only set what they mean to
+inline void merge_render_settings(RenderSettings *settings, RenderSettings *overrides) {
+	if (overrides == NULL) {
+		return;
+	}
+	if (overrides->tile_rows) {
+		settings->tile_rows = overrides->tile_rows;
+	}
+	if (overrides->tile_cols) {
+		settings->tile_cols = overrides->tile_cols;
+	}
+	if (overrides->num_samples) {
+		settings->num_samples = overrides->num_samples;
+	}
+	if (overrides->max_depth) {
+		settings->max_depth = overrides->max_depth;
+	}
+	if (overrides->mode) {
+		settings->mode = overrides->mode;
+	}
+	if (overrides->adaptive) {
+		settings->adaptive = overrides->adaptive;
+	}
+	if (overrides->adaptive_threshold) {
+		settings->adaptive_threshold = overrides->adaptive_threshold;
+	}
+	if (overrides->min_samples) {
+		settings->min_samples = overrides->min_samples;
+	}
+	if (overrides->light_sampling) {
+		settings->light_sampling = overrides->light_sampling;
+	}
+	if (overrides->russian_roulette) {
+		settings->russian_roulette = overrides->russian_roulette;
+	}
+	if (overrides->roulette_depth) {
+		settings->roulette_depth = overrides->roulette_depth;
+	}
+	if (overrides->progressive) {
+		settings->progressive = overrides->progressive;
+	}
+	if (overrides->pass_samples) {
+		settings->pass_samples = overrides->pass_samples;
+	}
+	if (overrides->time_budget) {
+		settings->time_budget = overrides->time_budget;
+	}
+	if (overrides->deterministic) {
+		settings->deterministic = overrides->deterministic;
+	}
+	if (overrides->seed) {
+		settings->seed = overrides->seed;
+	}
+	if (overrides->image_rows) {
+		settings->image_rows = overrides->image_rows;
+	}
+	if (overrides->quiet) {
+		settings->quiet = overrides->quiet;
+	}
+	if (overrides->skip_image_write) {
+		settings->skip_image_write = overrides->skip_image_write;
+	}
+	if (overrides->profile_tiles) {
+		settings->profile_tiles = overrides->profile_tiles;
+	}
+	if (overrides->hardware_counters) {
+		settings->hardware_counters = overrides->hardware_counters;
+	}
+	if (overrides->path_stats) {
+		settings->path_stats = overrides->path_stats;
+	}
+	if (overrides->float_format) {
+		settings->float_format = overrides->float_format;
+	}
+	if (overrides->streaming) {
+		settings->streaming = overrides->streaming;
+	}
+	if (overrides->image_format) {
+		settings->image_format = overrides->image_format;
+	}
+	if (overrides->checkpoint_interval) {
+		settings->checkpoint_interval = overrides->checkpoint_interval;
+	}
+	if (overrides->resume) {
+		settings->resume = overrides->resume;
+	}
+	if (overrides->save_scene) {
+		settings->save_scene = overrides->save_scene;
+	}
+}
+
 struct RenderJob {
 	PRNGState prng_state;
 	RGBA *background;
 	World *world;
-	Camera *camera;
+	PreparedCamera *camera;
 	u32 rows;
 	u32 cols;
 	u32 row_min;
 	u32 row_max;
 	u32 col_min;
 	u32 col_max;
-	u32 num_samples;
+	u32 num_samples; // total every pixel should have once the job is done
 	u32 max_depth;
-	u32 *out;
+	u32 tile_index; // in the grid of tiles, halves of a split job keep it
+	RenderSettings *settings;
+	Film *film; // when streaming, a film of just this tile while it renders
+	u32 *out; // NULL when streaming
+};
+
+// tiles smaller than this along both axes are never split when stolen
+#define MIN_SPLIT_TILE_SIZE 8
+
+// A contiguous range [begin, end) of job indices owned by one worker.
+// The owner takes from the front, thieves take from the back.
+struct alignas(CACHE_LINE_SIZE) TileDeque {
+	volatile u32 lock;
+	volatile u32 begin;
+	volatile u32 end;
+};
+
+// Work done on one tile, added into the worker's slot when the tile is done
+struct TileStats {
+	u64 ray_count;
+	u64 segment_count; // path rays only, no shadow rays
+	u64 pixel_count;
+	u64 sample_count;
+};
+
+// Only ever written by its own worker, so no locked adds. Readers sum all
+// slots whenever they want a total.
+struct alignas(CACHE_LINE_SIZE) WorkerStats {
+	volatile u64 ray_count;
+	volatile u64 segment_count;
+	volatile u64 pixel_count;
+	volatile u64 sample_count;
+	volatile u64 tile_count;
+};
+
+// When and where one tile was rendered, kept when profiling tiles
+struct TileRecord {
+	f64 start; // tick() values
+	f64 end;
+	u32 worker;
+	u32 pass;
+	u32 row_min;
+	u32 row_max;
+	u32 col_min;
+	u32 col_max;
+	u64 ray_count;
+	u64 sample_count;
 };
 
+struct PerfCounters;
+struct PathStats;
+struct Checkpoint;
+
 struct RenderQueue {
 	u32 num_tiles;
+	u32 max_tiles; // capacity of jobs, split tiles are appended
+	u32 num_workers;
 	RenderJob *jobs;
-	volatile u64 next_job_index;
-	volatile u64 tile_rendered_count;
+	TileDeque *deques;
+	WorkerStats *worker_stats;
+	f64 deadline; // tick() past which no more tiles are handed out, 0 for none
+	b8 fixed_tiles; // no splitting, what each tile covers can't depend on timing
+#ifdef YELLOW_SHARED_COUNTERS
+	// NOTE(dd): the old layout, every tile does locked adds on one line.
+	// Kept around to compare scaling against.
 	volatile u64 ray_count;
+	volatile u64 segment_count;
+	volatile u64 pixel_count;
+	volatile u64 sample_count;
+#endif
+	alignas(CACHE_LINE_SIZE) volatile u64 next_split_index;
+	// NULL unless profiling, room for max_tile_records
+	TileRecord *tile_records;
+	u64 max_tile_records;
+	u32 pass; // for the records
+	PerfCounters *perf_counters; // NULL unless counting, one per worker
+	PathStats *path_stats; // same
+	FloatImage *float_image; // NULL unless writing one
+	volatile u64 float_write_failures;
+	b8 streaming;
+	TiledImage *tiled_image; // NULL when streaming without writing
+	volatile u64 tiled_write_failures;
+	Checkpoint *checkpoint; // NULL unless checkpointing
+	alignas(CACHE_LINE_SIZE) volatile u64 num_tile_records;
 };
+
+inline void record_tile(RenderQueue *render_queue, u32 worker_index, TileStats *tile_stats) {
+#ifdef YELLOW_SHARED_COUNTERS
+	sync_fetch_and_add(&render_queue->ray_count, tile_stats->ray_count);
+	sync_fetch_and_add(&render_queue->segment_count, tile_stats->segment_count);
+	sync_fetch_and_add(&render_queue->pixel_count, tile_stats->pixel_count);
+	sync_fetch_and_add(&render_queue->sample_count, tile_stats->sample_count);
+#else
+	WorkerStats *stats = render_queue->worker_stats + worker_index;
+	stats->ray_count += tile_stats->ray_count;
+	stats->segment_count += tile_stats->segment_count;
+	stats->pixel_count += tile_stats->pixel_count;
+	stats->sample_count += tile_stats->sample_count;
+	stats->tile_count += 1;
+#endif
+}
+
+inline TileStats total_stats(RenderQueue *render_queue) {
+	TileStats total = {};
+#ifdef YELLOW_SHARED_COUNTERS
+	total.ray_count = render_queue->ray_count;
+	total.segment_count = render_queue->segment_count;
+	total.pixel_count = render_queue->pixel_count;
+	total.sample_count = render_queue->sample_count;
+#else
+	for (u32 w = 0; w < render_queue->num_workers; w++) {
+		WorkerStats *stats = render_queue->worker_stats + w;
+		total.ray_count += stats->ray_count;
+		total.segment_count += stats->segment_count;
+		total.pixel_count += stats->pixel_count;
+		total.sample_count += stats->sample_count;
+	}
+#endif
+	return total;
+}
+
+// Give every worker an equal run of tiles, in order, so each one starts on a
+// spatially contiguous band of the image. Called again before every pass,
+// worker stats keep adding up across passes.
+inline void reset_tile_deques(RenderQueue *render_queue) {
+	u32 num_workers = render_queue->num_workers;
+	u32 num_tiles = render_queue->num_tiles;
+	render_queue->next_split_index = num_tiles;
+	for (u32 w = 0; w < num_workers; w++) {
+		TileDeque *deque = render_queue->deques + w;
+		deque->lock = 0;
+		deque->begin = (u32) (((u64) num_tiles * w) / num_workers);
+		deque->end = (u32) (((u64) num_tiles * (w + 1)) / num_workers);
+	}
+}
+
+inline void seed_tile_deques(RenderQueue *render_queue, u32 num_workers) {
+	render_queue->num_workers = num_workers;
+	render_queue->deques = (TileDeque *) cache_aligned_malloc(sizeof(TileDeque) * num_workers);
+	render_queue->worker_stats = (WorkerStats *) cache_aligned_malloc(sizeof(WorkerStats) * num_workers);
+	for (u32 w = 0; w < num_workers; w++) {
+		render_queue->worker_stats[w] = (WorkerStats) {};
+	}
+	reset_tile_deques(render_queue);
+}
+
+inline void free_render_queue(RenderQueue *render_queue) {
+	free(render_queue->tile_records);
+	cache_aligned_free(render_queue->perf_counters);
+	cache_aligned_free(render_queue->path_stats);
+	cache_aligned_free(render_queue->deques);
+	cache_aligned_free(render_queue->worker_stats);
+	free(render_queue->jobs);
+}
+
+// Cut the far half off a job that nobody has started yet and return the
+// index of the new job holding it, or UINT32_MAX if it's too small to split.
+// Caller must hold the lock of the deque the job sits in.
+inline u32 split_tile(RenderQueue *render_queue, u32 job_index) {
+	if (render_queue->fixed_tiles) {
+		return UINT32_MAX;
+	}
+	RenderJob *job = render_queue->jobs + job_index;
+	u32 tile_rows = job->row_max - job->row_min;
+	u32 tile_cols = job->col_max - job->col_min;
+	if ((tile_rows < 2 * MIN_SPLIT_TILE_SIZE) && (tile_cols < 2 * MIN_SPLIT_TILE_SIZE)) {
+		return UINT32_MAX;
+	}
+	u64 split_index = sync_fetch_and_add(&render_queue->next_split_index, 1);
+	if (split_index >= render_queue->max_tiles) {
+		return UINT32_MAX;
+	}
+	RenderJob *split = render_queue->jobs + split_index;
+	*split = *job;
+	if (tile_rows >= tile_cols) {
+		u32 row_mid = job->row_min + (tile_rows / 2);
+		job->row_max = row_mid;
+		split->row_min = row_mid;
+	} else {
+		u32 col_mid = job->col_min + (tile_cols / 2);
+		job->col_max = col_mid;
+		split->col_min = col_mid;
+	}
+	// decorrelate the two halves
+	split->prng_state.entropy = xor_shift32(&split->prng_state);
+	warm_up_xor_shift(&split->prng_state);
+	return (u32) split_index;
+}
+
+// Move half of the fullest other deque into ours. When the victim is down to
+// its last tile we split that tile instead, so the tail of a render doesn't
+// wait on one big expensive tile.
+inline b8 steal_tiles(RenderQueue *render_queue, u32 worker_index) {
+	u32 num_workers = render_queue->num_workers;
+	while (true) {
+		u32 victim_index = UINT32_MAX;
+		u32 most_remaining = 0;
+		for (u32 i = 1; i < num_workers; i++) {
+			u32 w = (worker_index + i) % num_workers;
+			TileDeque *deque = render_queue->deques + w;
+			u32 remaining = deque->end - deque->begin;
+			if ((deque->end > deque->begin) && (remaining > most_remaining)) {
+				most_remaining = remaining;
+				victim_index = w;
+			}
+		}
+		if (victim_index == UINT32_MAX) {
+			return false;
+		}
+		TileDeque *victim = render_queue->deques + victim_index;
+		u32 begin = 0;
+		u32 end = 0;
+		spin_lock(&victim->lock);
+		u32 remaining = victim->end - victim->begin;
+		if (victim->end <= victim->begin) {
+			// someone got here first, look again
+			spin_unlock(&victim->lock);
+			continue;
+		} else if (remaining == 1) {
+			u32 split_index = split_tile(render_queue, victim->begin);
+			if (split_index == UINT32_MAX) {
+				begin = victim->begin;
+				end = victim->end;
+				victim->end = victim->begin;
+			} else {
+				begin = split_index;
+				end = split_index + 1;
+			}
+		} else {
+			u32 mid = victim->begin + (remaining / 2);
+			begin = mid;
+			end = victim->end;
+			victim->end = mid;
+		}
+		spin_unlock(&victim->lock);
+		TileDeque *deque = render_queue->deques + worker_index;
+		spin_lock(&deque->lock);
+		deque->begin = begin;
+		deque->end = end;
+		spin_unlock(&deque->lock);
+		return true;
+	}
+}
+
+// Index of the next job this worker should render, or UINT32_MAX when every
+// deque is empty
+inline u32 next_tile(RenderQueue *render_queue, u32 worker_index) {
+	TileDeque *deque = render_queue->deques + worker_index;
+	while (true) {
+		u32 job_index = UINT32_MAX;
+		spin_lock(&deque->lock);
+		if (deque->begin < deque->end) {
+			job_index = deque->begin++;
+		}
+		spin_unlock(&deque->lock);
+		if (job_index != UINT32_MAX) {
+			return job_index;
+		}
+		if (!steal_tiles(render_queue, worker_index)) {
+			return UINT32_MAX;
+		}
+	}
+}
+
+// Work handed to every pool thread, worker_index runs from 1 to num_threads
+// since the thread that submits the work is worker 0
+typedef void (*PoolTask)(void *args, u32 worker_index);
+
+struct RenderPool;
+struct ImageWriter;
+
+struct PoolThread {
+	RenderPool *pool;
+	u32 worker_index;
+	u64 generation; // last generation of work this thread picked up
+};
+
+// Long-lived worker threads that sleep between renders, so rendering many
+// small frames doesn't pay for thread creation every time
+struct RenderPool {
+	u32 num_threads;
+	ThreadHandle *threads;
+	PoolThread *pool_threads;
+	Mutex mutex;
+	Condition work_ready;
+	Condition work_done;
+	u64 generation;
+	u32 busy_count;
+	b8 shutting_down;
+	PoolTask task;
+	void *task_args;
+	// NULL to write images on the rendering thread, otherwise renders hand
+	// their images to it and return
+	ImageWriter *writer;
+};
+
+inline threaded render_pool_thread(void *args) {
+	PoolThread *pool_thread = (PoolThread *) args;
+	RenderPool *pool = pool_thread->pool;
+	while (true) {
+		lock_mutex(&pool->mutex);
+		while ((pool->generation == pool_thread->generation) && !pool->shutting_down) {
+			wait_condition(&pool->work_ready, &pool->mutex);
+		}
+		if (pool->shutting_down) {
+			unlock_mutex(&pool->mutex);
+			break;
+		}
+		pool_thread->generation = pool->generation;
+		PoolTask task = pool->task;
+		void *task_args = pool->task_args;
+		unlock_mutex(&pool->mutex);
+		task(task_args, pool_thread->worker_index);
+		lock_mutex(&pool->mutex);
+		pool->busy_count--;
+		if (pool->busy_count == 0) {
+			wake_all(&pool->work_done);
+		}
+		unlock_mutex(&pool->mutex);
+	}
+	return 0;
+}
+
+inline RenderPool *create_render_pool(u32 num_threads) {
+	RenderPool *pool = (RenderPool *) malloc(sizeof(RenderPool));
+	pool->num_threads = num_threads;
+	pool->threads = (ThreadHandle *) malloc(sizeof(ThreadHandle) * num_threads);
+	pool->pool_threads = (PoolThread *) malloc(sizeof(PoolThread) * num_threads);
+	init_mutex(&pool->mutex);
+	init_condition(&pool->work_ready);
+	init_condition(&pool->work_done);
+	pool->generation = 0;
+	pool->busy_count = 0;
+	pool->shutting_down = false;
+	pool->task = NULL;
+	pool->task_args = NULL;
+	pool->writer = NULL;
+	for (u32 i = 0; i < num_threads; i++) {
+		pool->pool_threads[i] = (PoolThread) {pool, i + 1, 0};
+		pool->threads[i] = create_thread(render_pool_thread, (void *) &pool->pool_threads[i]);
+	}
+	return pool;
+}
+
+// Wake every pool thread on task and return right away, the caller is
+// expected to do its share as worker 0 and then call wait_render_pool
+inline void start_render_pool(RenderPool *pool, PoolTask task, void *args) {
+	lock_mutex(&pool->mutex);
+	pool->task = task;
+	pool->task_args = args;
+	pool->busy_count = pool->num_threads;
+	pool->generation++;
+	wake_all(&pool->work_ready);
+	unlock_mutex(&pool->mutex);
+}
+
+inline void wait_render_pool(RenderPool *pool) {
+	lock_mutex(&pool->mutex);
+	while (pool->busy_count > 0) {
+		wait_condition(&pool->work_done, &pool->mutex);
+	}
+	unlock_mutex(&pool->mutex);
+}
+
+inline void destroy_render_pool(RenderPool *pool) {
+	lock_mutex(&pool->mutex);
+	pool->shutting_down = true;
+	wake_all(&pool->work_ready);
+	unlock_mutex(&pool->mutex);
+	for (u32 i = 0; i < pool->num_threads; i++) {
+		join_thread(pool->threads[i]);
+	}
+	destroy_condition(&pool->work_ready);
+	destroy_condition(&pool->work_done);
+	destroy_mutex(&pool->mutex);
+	free(pool->threads);
+	free(pool->pool_threads);
+	free(pool);
+}
 #endif //YELLOW_THREADS
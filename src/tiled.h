@@ -0,0 +1,193 @@
+#ifndef YELLOW_TILED
+#define YELLOW_TILED
+#include <cstdlib>
+#include <cstring>
+#include "types.h"
+#include "colors.h"
+#include "film.h"
+#include "files.h"
+
+// An 8 bit RGB tiled TIFF on disk that the streaming renderer drops finished
+// tiles into, so the image never has to exist in memory at once. Render
+// tiles and TIFF tiles are the same, and every TIFF tile is stored whole
+// (edge tiles padded) at a fixed offset, so each one is a single positional
+// write. Past 4GB we switch to BigTIFF, which has 64 bit offsets.
+
+// TIFF wants tile sides in multiples of this
+#define TIFF_TILE_ALIGNMENT 16
+
+enum TiffType {
+	TIFF_SHORT = 3,
+	TIFF_LONG = 4,
+	TIFF_LONG8 = 16,
+};
+
+struct TiledImage {
+	FileHandle file;
+	u32 rows;
+	u32 cols;
+	u32 tile_rows;
+	u32 tile_cols;
+	u32 tiles_across;
+	u64 tile_bytes;
+	u64 data_offset; // where the first tile goes, the rest follow in order
+};
+
+// The header, directory and out of line tag values, built in memory
+struct TiffWriter {
+	u8 *bytes;
+	b8 big;
+	u64 entry_offset; // next directory entry
+	u64 extra_offset; // next out of line value
+};
+
+inline void put_tiff_entry(TiffWriter *writer, u16 tag, TiffType type, u64 count, const void *values) {
+	u64 value_size = (type == TIFF_SHORT) ? 2 : ((type == TIFF_LONG) ? 4 : 8);
+	u64 inline_size = writer->big ? 8 : 4;
+	u64 size = count * value_size;
+	u8 *entry = writer->bytes + writer->entry_offset;
+	u16 type_code = (u16) type;
+	memcpy(entry, &tag, 2);
+	memcpy(entry + 2, &type_code, 2);
+	if (writer->big) {
+		memcpy(entry + 4, &count, 8);
+	} else {
+		u32 count32 = (u32) count;
+		memcpy(entry + 4, &count32, 4);
+	}
+	u8 *value = entry + (writer->big ? 12 : 8);
+	if (size <= inline_size) {
+		memcpy(value, values, size);
+	} else {
+		memcpy(writer->bytes + writer->extra_offset, values, size);
+		if (writer->big) {
+			memcpy(value, &writer->extra_offset, 8);
+		} else {
+			u32 offset32 = (u32) writer->extra_offset;
+			memcpy(value, &offset32, 4);
+		}
+		writer->extra_offset += (size + 7) & ~7ull;
+	}
+	writer->entry_offset += writer->big ? 20 : 12;
+}
+
+inline b8 open_tiled_image(
+	TiledImage *image,
+	const char *path,
+	u32 rows,
+	u32 cols,
+	u32 tile_rows,
+	u32 tile_cols
+) {
+	*image = {};
+	image->rows = rows;
+	image->cols = cols;
+	image->tile_rows = tile_rows;
+	image->tile_cols = tile_cols;
+	image->tiles_across = (cols + tile_cols - 1) / tile_cols;
+	u64 num_tiles = (u64) image->tiles_across * ((rows + tile_rows - 1) / tile_rows);
+	image->tile_bytes = 3ull * tile_rows * tile_cols;
+	u64 data_size = num_tiles * image->tile_bytes;
+	const u32 num_entries = 11;
+	TiffWriter writer = {};
+	// leave a little room under 4GB for the header and tile tables
+	writer.big = (data_size + 16 * num_tiles + 4096) > 0xffffffffull;
+	u64 header_size = writer.big ? 16 : 8;
+	u64 directory_size = writer.big ? (8 + 20 * num_entries + 8) : (2 + 12 * num_entries + 4);
+	u64 offset_size = writer.big ? 8 : 4;
+	u64 extra_size = 8 + 2 * (num_tiles * offset_size + 8);
+	// start the pixels on a page so tile writes line up with the disk
+	image->data_offset = (header_size + directory_size + extra_size + 4095) & ~4095ull;
+	writer.bytes = (u8 *) calloc(image->data_offset, 1);
+	if (writer.big) {
+		u16 header[4] = {0x4949, 43, 8, 0}; // "II", BigTIFF, 8 byte offsets
+		u64 directory = header_size;
+		u64 count = num_entries;
+		memcpy(writer.bytes, header, sizeof(header));
+		memcpy(writer.bytes + 8, &directory, 8);
+		memcpy(writer.bytes + header_size, &count, 8);
+		writer.entry_offset = header_size + 8;
+	} else {
+		u16 header[2] = {0x4949, 42}; // "II", little endian TIFF
+		u32 directory = (u32) header_size;
+		u16 count = num_entries;
+		memcpy(writer.bytes, header, sizeof(header));
+		memcpy(writer.bytes + 4, &directory, 4);
+		memcpy(writer.bytes + header_size, &count, 2);
+		writer.entry_offset = header_size + 2;
+	}
+	// the next directory offset after the entries stays 0
+	writer.extra_offset = header_size + directory_size;
+	u32 width = cols;
+	u32 height = rows;
+	u16 bits_per_sample[3] = {8, 8, 8};
+	u16 no_compression = 1;
+	u16 photometric_rgb = 2;
+	u16 samples_per_pixel = 3;
+	u16 planar_contiguous = 1;
+	u8 *tile_offsets = (u8 *) malloc(num_tiles * offset_size);
+	u8 *tile_byte_counts = (u8 *) malloc(num_tiles * offset_size);
+	for (u64 t = 0; t < num_tiles; t++) {
+		u64 offset = image->data_offset + t * image->tile_bytes;
+		u64 count = image->tile_bytes;
+		// little endian, so the low bytes are the 32 bit value
+		memcpy(tile_offsets + t * offset_size, &offset, offset_size);
+		memcpy(tile_byte_counts + t * offset_size, &count, offset_size);
+	}
+	TiffType offset_type = writer.big ? TIFF_LONG8 : TIFF_LONG;
+	// entries have to be sorted by tag
+	put_tiff_entry(&writer, 256, TIFF_LONG, 1, &width);
+	put_tiff_entry(&writer, 257, TIFF_LONG, 1, &height);
+	put_tiff_entry(&writer, 258, TIFF_SHORT, 3, bits_per_sample);
+	put_tiff_entry(&writer, 259, TIFF_SHORT, 1, &no_compression);
+	put_tiff_entry(&writer, 262, TIFF_SHORT, 1, &photometric_rgb);
+	put_tiff_entry(&writer, 277, TIFF_SHORT, 1, &samples_per_pixel);
+	put_tiff_entry(&writer, 284, TIFF_SHORT, 1, &planar_contiguous);
+	put_tiff_entry(&writer, 322, TIFF_LONG, 1, &tile_cols);
+	put_tiff_entry(&writer, 323, TIFF_LONG, 1, &tile_rows);
+	put_tiff_entry(&writer, 324, offset_type, num_tiles, tile_offsets);
+	put_tiff_entry(&writer, 325, offset_type, num_tiles, tile_byte_counts);
+	free(tile_offsets);
+	free(tile_byte_counts);
+	image->file = create_file(path);
+	b8 ok = image->file != INVALID_FILE;
+	ok = ok && write_at(image->file, 0, writer.bytes, image->data_offset);
+	// NOTE(dd): sparse where the filesystem allows, disk fills up as tiles land
+	ok = ok && resize_file(image->file, image->data_offset + data_size);
+	free(writer.bytes);
+	if (!ok && (image->file != INVALID_FILE)) {
+		close_file(image->file);
+		image->file = INVALID_FILE;
+	}
+	return ok;
+}
+
+inline void close_tiled_image(TiledImage *image) {
+	if (image->file != INVALID_FILE) {
+		close_file(image->file);
+		image->file = INVALID_FILE;
+	}
+}
+
+// Gamma encode the film over one tile and write it to its slot. The tile
+// has to start on the TIFF tile grid, which render tiles do when they are
+// never split.
+inline b8 write_tiled_image_tile(TiledImage *image, Film *film, u32 row_min, u32 row_max, u32 col_min, u32 col_max) {
+	u64 tile_index = (u64) (row_min / image->tile_rows) * image->tiles_across + (col_min / image->tile_cols);
+	u8 *tile = (u8 *) calloc(image->tile_bytes, 1);
+	for (u32 i = row_min; i < row_max; i++) {
+		u8 *pixel = tile + 3ull * (i - row_min) * image->tile_cols;
+		for (u32 j = col_min; j < col_max; j++) {
+			RGBA color = resolve_pixel(film, film_index(film, i, j));
+			u32 hex = rgba_to_u32(&color);
+			pixel[0] = (u8) (hex >> 0);
+			pixel[1] = (u8) (hex >> 8);
+			pixel[2] = (u8) (hex >> 16);
+			pixel += 3;
+		}
+	}
+	b8 ok = write_at(image->file, image->data_offset + tile_index * image->tile_bytes, tile, image->tile_bytes);
+	free(tile);
+	return ok;
+}
+#endif //YELLOW_TILED
@@ -0,0 +1,264 @@
+#ifndef YELLOW_WAVEFRONT
+#define YELLOW_WAVEFRONT
+#include <cstdlib>
+#include "types.h"
+#include "colors.h"
+#include "materials.h"
+#include "cameras.h"
+#include "film.h"
+#include "threads.h"
+#include "ray.h"
+#include "stats.h"
+
+// Instead of following one path to the end before starting the next, the
+// wavefront renderer keeps a batch of paths in flight and moves all of them
+// one bounce at a time: intersect everything, sort the hits by what kind of
+// material they landed on, shade each kind in its own loop, then pack the
+// paths that are still alive to the front for the next bounce.
+#define WAVEFRONT_BATCH_SIZE 4096
+
+enum MaterialKind {
+	MATERIAL_KIND_DIFFUSE,
+	MATERIAL_KIND_MIRROR,
+	MATERIAL_KIND_FUZZY,
+	MATERIAL_KIND_REFRACT,
+	MATERIAL_KIND_COUNT,
+};
+
+struct WavefrontPath {
+	Ray ray;
+	RGBA attenuation;
+	u32 pixel; // index into the tile
+};
+
+struct WavefrontHit {
+	Point3D origin;
+	Vec3D normal;
+	b8 inside;
+	u32 material_index;
+	u32 path; // index into the current batch
+};
+
+struct WavefrontBatch {
+	u32 num_paths;
+	WavefrontPath *paths;
+	WavefrontPath *next_paths;
+	Ray *camera_rays; // scratch for generating a row of camera rays at once
+	u32 bucket_counts[MATERIAL_KIND_COUNT];
+	WavefrontHit *buckets[MATERIAL_KIND_COUNT];
+};
+
+// Same branch order as trace: refract, then scatter's diffuse/mirror/fuzzy
+inline MaterialKind material_kind(Material *material) {
+	if (material->refractive_index > 0.0) {
+		return MATERIAL_KIND_REFRACT;
+	} else if (material->scatter_index == 1.0) {
+		return MATERIAL_KIND_DIFFUSE;
+	} else if (material->scatter_index == 0.0) {
+		return MATERIAL_KIND_MIRROR;
+	}
+	return MATERIAL_KIND_FUZZY;
+}
+
+inline WavefrontBatch create_wavefront_batch() {
+	WavefrontBatch batch = {};
+	batch.paths = (WavefrontPath *) malloc(sizeof(WavefrontPath) * WAVEFRONT_BATCH_SIZE);
+	batch.next_paths = (WavefrontPath *) malloc(sizeof(WavefrontPath) * WAVEFRONT_BATCH_SIZE);
+	batch.camera_rays = (Ray *) malloc(sizeof(Ray) * WAVEFRONT_BATCH_SIZE);
+	for (u32 k = 0; k < MATERIAL_KIND_COUNT; k++) {
+		batch.buckets[k] = (WavefrontHit *) malloc(sizeof(WavefrontHit) * WAVEFRONT_BATCH_SIZE);
+	}
+	return batch;
+}
+
+inline void free_wavefront_batch(WavefrontBatch *batch) {
+	free(batch->paths);
+	free(batch->next_paths);
+	free(batch->camera_rays);
+	for (u32 k = 0; k < MATERIAL_KIND_COUNT; k++) {
+		free(batch->buckets[k]);
+	}
+}
+
+// Intersect every path in the batch, retire the ones that escape or lose at
+// roulette and file the rest under the kind of material they hit
+inline void intersect_wavefront(
+	WavefrontBatch *batch,
+	World *world,
+	RGBA *background,
+	RGBA *colors,
+	PRNGState *prng_state,
+	b8 roulette,
+	u32 num_segments, // traced so far by every path in the batch, this one included
+	PathStats *path_stats
+) {
+	for (u32 k = 0; k < MATERIAL_KIND_COUNT; k++) {
+		batch->bucket_counts[k] = 0;
+	}
+	for (u32 i = 0; i < batch->num_paths; i++) {
+		WavefrontPath *path = batch->paths + i;
+		Intersection intersection = find_intersection(&path->ray, world);
+		if (!intersection.intersected) {
+			colors[path->pixel] += path->attenuation * *background;
+			count_path_end(path_stats, PATH_END_ESCAPED, num_segments);
+			continue;
+		}
+		Material *material = world->materials + intersection.material_index;
+		colors[path->pixel] += path->attenuation * material->emit;
+		path->attenuation *= material->color;
+		if (roulette && !survive_roulette(prng_state, &path->attenuation)) {
+			count_path_end(path_stats, PATH_END_ROULETTE, num_segments);
+			continue;
+		}
+		MaterialKind kind = material_kind(material);
+		WavefrontHit *hit = batch->buckets[kind] + batch->bucket_counts[kind]++;
+		hit->origin = intersection.origin;
+		hit->normal = intersection.normal;
+		hit->inside = intersection.inside;
+		hit->material_index = intersection.material_index;
+		hit->path = i;
+	}
+}
+
+// Shade one material kind at a time and write the bounced paths packed into
+// next_paths, then swap so they become the next bounce
+inline void shade_wavefront(WavefrontBatch *batch, World *world, PRNGState *prng_state, PathStats *path_stats) {
+	if (path_stats) {
+		path_stats->events[PATH_EVENT_DIFFUSE] += batch->bucket_counts[MATERIAL_KIND_DIFFUSE];
+		path_stats->events[PATH_EVENT_MIRROR] += batch->bucket_counts[MATERIAL_KIND_MIRROR];
+		path_stats->events[PATH_EVENT_FUZZY] += batch->bucket_counts[MATERIAL_KIND_FUZZY];
+	}
+	u32 num_next = 0;
+	WavefrontHit *hits = batch->buckets[MATERIAL_KIND_DIFFUSE];
+	for (u32 i = 0; i < batch->bucket_counts[MATERIAL_KIND_DIFFUSE]; i++) {
+		WavefrontPath *path = batch->paths + hits[i].path;
+		WavefrontPath *next = batch->next_paths + num_next++;
+		next->ray = diffuse_bounce(prng_state, &path->ray, &hits[i].normal, &hits[i].origin, path_stats);
+		next->attenuation = path->attenuation;
+		next->pixel = path->pixel;
+	}
+	hits = batch->buckets[MATERIAL_KIND_MIRROR];
+	for (u32 i = 0; i < batch->bucket_counts[MATERIAL_KIND_MIRROR]; i++) {
+		WavefrontPath *path = batch->paths + hits[i].path;
+		WavefrontPath *next = batch->next_paths + num_next++;
+		next->ray = reflect(&path->ray, &hits[i].normal, &hits[i].origin);
+		next->attenuation = path->attenuation;
+		next->pixel = path->pixel;
+	}
+	hits = batch->buckets[MATERIAL_KIND_FUZZY];
+	for (u32 i = 0; i < batch->bucket_counts[MATERIAL_KIND_FUZZY]; i++) {
+		WavefrontPath *path = batch->paths + hits[i].path;
+		WavefrontPath *next = batch->next_paths + num_next++;
+		f32 scatter_index = world->materials[hits[i].material_index].scatter_index;
+		next->ray = fuzzy_reflect(prng_state, &path->ray, &hits[i].normal, &hits[i].origin, scatter_index, path_stats);
+		next->attenuation = path->attenuation;
+		next->pixel = path->pixel;
+	}
+	hits = batch->buckets[MATERIAL_KIND_REFRACT];
+	for (u32 i = 0; i < batch->bucket_counts[MATERIAL_KIND_REFRACT]; i++) {
+		WavefrontPath *path = batch->paths + hits[i].path;
+		WavefrontPath *next = batch->next_paths + num_next++;
+		f32 refractive_index = world->materials[hits[i].material_index].refractive_index;
+		next->ray = refract(prng_state, &path->ray, &hits[i].normal, &hits[i].origin, hits[i].inside, refractive_index, path_stats);
+		next->attenuation = path->attenuation;
+		next->pixel = path->pixel;
+	}
+	WavefrontPath *tmp = batch->paths;
+	batch->paths = batch->next_paths;
+	batch->next_paths = tmp;
+	batch->num_paths = num_next;
+}
+
+// Same image as render_tile_paths, statistically. Every pixel of the tile
+// takes the same number of new samples, enough to bring the least sampled
+// one up to num_samples.
+inline void render_tile_wavefront(RenderJob *render_job, TileStats *tile_stats, PathStats *path_stats) {
+	PRNGState *prng_state = &render_job->prng_state;
+	RGBA *background = render_job->background;
+	World *world = render_job->world;
+	PreparedCamera *camera = render_job->camera;
+	u32 cols = render_job->cols;
+	u32 row_min = render_job->row_min;
+	u32 col_min = render_job->col_min;
+	u32 tile_rows = render_job->row_max - row_min;
+	u32 tile_cols = render_job->col_max - col_min;
+	u32 num_samples = render_job->num_samples;
+	u32 max_depth = render_job->max_depth;
+	u32 *out = render_job->out;
+	RenderSettings *settings = render_job->settings;
+	Film *film = render_job->film;
+	u32 roulette_depth = settings->roulette_depth ? settings->roulette_depth : DEFAULT_ROULETTE_DEPTH;
+	u32 num_pixels = tile_rows * tile_cols;
+	u32 fewest_samples = UINT32_MAX;
+	for (u32 p = 0; p < num_pixels; p++) {
+		u64 index = film_index(film, row_min + (p / tile_cols), col_min + (p % tile_cols));
+		if (film->counts[index] < fewest_samples) {
+			fewest_samples = film->counts[index];
+		}
+	}
+	if (fewest_samples >= num_samples) {
+		return;
+	}
+	num_samples -= fewest_samples;
+	RGBA *colors = (RGBA *) malloc(sizeof(RGBA) * num_pixels);
+	for (u32 p = 0; p < num_pixels; p++) {
+		colors[p] = (RGBA) {0.0, 0.0, 0.0, 0.0};
+	}
+	WavefrontBatch batch = create_wavefront_batch();
+	u32 num_traced_rays = 0;
+	u64 num_paths = (u64) num_pixels * num_samples;
+	for (u64 first = 0; first < num_paths; first += WAVEFRONT_BATCH_SIZE) {
+		// camera rays for the next slice of (sample, pixel) pairs, sample
+		// major so a slice is made of whole runs of neighbouring pixels
+		u64 last = first + WAVEFRONT_BATCH_SIZE;
+		if (last > num_paths) {
+			last = num_paths;
+		}
+		batch.num_paths = 0;
+		u64 n = first;
+		while (n < last) {
+			u32 pixel = (u32) (n % num_pixels);
+			u32 tile_col = pixel % tile_cols;
+			u32 count = tile_cols - tile_col;
+			if (count > last - n) {
+				count = (u32) (last - n);
+			}
+			prime_ray_row(prng_state, camera, row_min + (pixel / tile_cols), col_min + tile_col, count, batch.camera_rays, path_stats);
+			for (u32 k = 0; k < count; k++) {
+				WavefrontPath *path = batch.paths + batch.num_paths++;
+				path->ray = batch.camera_rays[k];
+				path->attenuation = (RGBA) {1.0, 1.0, 1.0, 1.0};
+				path->pixel = pixel + k;
+			}
+			n += count;
+		}
+		for (u32 d = 0; (d < max_depth) && (batch.num_paths > 0); d++) {
+			num_traced_rays += batch.num_paths;
+			b8 roulette = settings->russian_roulette && (d + 1 >= roulette_depth);
+			intersect_wavefront(&batch, world, background, colors, prng_state, roulette, d + 1, path_stats);
+			shade_wavefront(&batch, world, prng_state, path_stats);
+		}
+		if (path_stats) {
+			path_stats->ends[PATH_END_MAX_DEPTH] += batch.num_paths;
+			path_stats->segments[(max_depth < PATH_STATS_MAX_SEGMENTS) ? max_depth : PATH_STATS_MAX_SEGMENTS] += batch.num_paths;
+		}
+	}
+	for (u32 p = 0; p < num_pixels; p++) {
+		u32 i = row_min + (p / tile_cols);
+		u32 j = col_min + (p % tile_cols);
+		u64 index = film_index(film, i, j);
+		// the path renderer starts every sample at alpha 1, so it's always opaque
+		colors[p].a = (f32) num_samples;
+		film->sums[index] += colors[p];
+		film->counts[index] += num_samples;
+	}
+	if (out) {
+		resolve_film(film, out, cols, row_min, row_min + tile_rows, col_min, col_min + tile_cols);
+	}
+	free_wavefront_batch(&batch);
+	free(colors);
+	tile_stats->ray_count = num_traced_rays;
+	tile_stats->segment_count = num_traced_rays;
+	tile_stats->sample_count = num_paths;
+}
+#endif //YELLOW_WAVEFRONT
@@ -0,0 +1,184 @@
+#ifndef YELLOW_WRITER
+#define YELLOW_WRITER
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "types.h"
+#include "threads.h"
+// NOTE(dd): stb_image_write comes in through render.h, which defines the
+// implementation and includes this file after it
+
+// Encodes and writes finished images on a thread of its own, so the render
+// pool can get on with the next frame (or pass) while a PNG compresses.
+// Writes are queued in order. A snapshot that hasn't been started yet is
+// replaced by a newer one of the same file, so slow encoding never backs up
+// more than one image per file.
+
+struct ImageWrite;
+
+// Writes something that isn't an image, like a checkpoint, false on failure
+typedef b8 (*WriteFunction)(ImageWrite *write);
+
+struct ImageWrite {
+	const char *path;
+	ImageFormat format;
+	u32 rows;
+	u32 cols;
+	void *pixels; // RGBA u32 for BMP and PNG, RGB f32 for HDR, freed once written
+	b8 quiet;
+	WriteFunction write_function; // NULL for images, otherwise takes over
+	ImageWrite *next;
+};
+
+struct ImageWriter {
+	ThreadHandle thread;
+	Mutex mutex;
+	Condition work_ready;
+	ImageWrite *first;
+	ImageWrite *last;
+	b8 shutting_down;
+	// totals printed when the writer is destroyed
+	f64 encode_seconds;
+	u32 num_written;
+	u32 num_replaced;
+};
+
+inline const char *image_path(ImageFormat format) {
+	if (format == IMAGE_FORMAT_PNG) {
+		return "image.png";
+	} else if (format == IMAGE_FORMAT_HDR) {
+		return "image.hdr";
+	}
+	return "image.bmp";
+}
+
+inline b8 encode_image(ImageWrite *write) {
+	if (write->write_function) {
+		return write->write_function(write);
+	}
+	i32 result = 0;
+	if (write->format == IMAGE_FORMAT_PNG) {
+		result = stbi_write_png(write->path, write->cols, write->rows, 4, write->pixels, write->cols * 4);
+	} else if (write->format == IMAGE_FORMAT_HDR) {
+		result = stbi_write_hdr(write->path, write->cols, write->rows, 3, (f32 *) write->pixels);
+	} else {
+		result = stbi_write_bmp(write->path, write->cols, write->rows, 4, write->pixels);
+	}
+	return result != 0;
+}
+
+// Encode and write on the calling thread, report how long it took and
+// free the pixels. Returns the seconds spent.
+inline f64 finish_image_write(ImageWrite *write, const char *where) {
+	f64 start = tick();
+	b8 ok = encode_image(write);
+	f64 seconds = tick() - start;
+	if (!ok) {
+		printf("[warn] could not write %s\n", write->path);
+	} else if (!write->quiet) {
+		printf("[info] wrote %s in %.4f seconds %s\n", write->path, seconds, where);
+	}
+	free(write->pixels);
+	return seconds;
+}
+
+inline threaded image_writer_thread(void *args) {
+	ImageWriter *writer = (ImageWriter *) args;
+	lock_mutex(&writer->mutex);
+	while (true) {
+		while (!writer->first && !writer->shutting_down) {
+			wait_condition(&writer->work_ready, &writer->mutex);
+		}
+		if (!writer->first) {
+			break;
+		}
+		ImageWrite *write = writer->first;
+		writer->first = write->next;
+		if (!writer->first) {
+			writer->last = NULL;
+		}
+		unlock_mutex(&writer->mutex);
+		f64 seconds = finish_image_write(write, "on the writer thread");
+		free(write);
+		lock_mutex(&writer->mutex);
+		writer->encode_seconds += seconds;
+		writer->num_written++;
+	}
+	unlock_mutex(&writer->mutex);
+	return 0;
+}
+
+inline ImageWriter *create_image_writer() {
+	ImageWriter *writer = (ImageWriter *) calloc(1, sizeof(ImageWriter));
+	init_mutex(&writer->mutex);
+	init_condition(&writer->work_ready);
+	writer->thread = create_thread(image_writer_thread, (void *) writer);
+	return writer;
+}
+
+// Hand over a write, the writer owns write.pixels from here on. Without a
+// writer it's done right away on the calling thread.
+inline void submit_write(ImageWriter *writer, ImageWrite write) {
+	const char *path = write.path;
+	write.next = NULL;
+	if (!writer) {
+		finish_image_write(&write, "on the render thread");
+		return;
+	}
+	lock_mutex(&writer->mutex);
+	for (ImageWrite *queued = writer->first; queued; queued = queued->next) {
+		if (strcmp(queued->path, path) == 0) {
+			free(queued->pixels);
+			write.next = queued->next;
+			*queued = write;
+			writer->num_replaced++;
+			unlock_mutex(&writer->mutex);
+			return;
+		}
+	}
+	ImageWrite *queued = (ImageWrite *) malloc(sizeof(ImageWrite));
+	*queued = write;
+	if (writer->last) {
+		writer->last->next = queued;
+	} else {
+		writer->first = queued;
+	}
+	writer->last = queued;
+	wake_all(&writer->work_ready);
+	unlock_mutex(&writer->mutex);
+}
+
+inline void submit_image(
+	ImageWriter *writer,
+	const char *path,
+	ImageFormat format,
+	u32 rows,
+	u32 cols,
+	void *pixels,
+	b8 quiet
+) {
+	ImageWrite write = {path, format, rows, cols, pixels, quiet, NULL, NULL};
+	submit_write(writer, write);
+}
+
+// Finishes whatever is still queued first, then reports the time spent
+// encoding, none of which held up the render
+inline void destroy_image_writer(ImageWriter *writer) {
+	lock_mutex(&writer->mutex);
+	writer->shutting_down = true;
+	wake_all(&writer->work_ready);
+	unlock_mutex(&writer->mutex);
+	join_thread(writer->thread);
+	if (writer->num_written > 0) {
+		printf(
+			"[info] writer thread wrote %u files (%u snapshots replaced before being written) in %.4f seconds of encoding\n",
+			writer->num_written,
+			writer->num_replaced,
+			writer->encode_seconds
+		);
+	}
+	destroy_condition(&writer->work_ready);
+	destroy_mutex(&writer->mutex);
+	free(writer);
+}
+#endif //YELLOW_WRITER